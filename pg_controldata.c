@@ -36,6 +36,11 @@
 #include "miscadmin.h"
 #include "catalog/pg_control.h"
 #include "catalog/pg_type.h"
+#include "portability/instr_time.h"
+#include "storage/ipc.h"
+#include "utils/guc.h"
+
+#include "pg_controldata.h"
 
 
 PG_MODULE_MAGIC;
@@ -51,50 +56,92 @@ PG_MODULE_MAGIC;
 #endif
 
 
-struct controldata
+/* Saved hook values in case of unload */
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* Shared state, set up by pgcd_shmem_startup() */
+pgcdSharedState *pgcd = NULL;
+
+void		_PG_init(void);
+void		_PG_fini(void);
+
+static void pgcd_shmem_startup(void);
+static pgcdCallOutcome get_controldata(ControlFileData *ControlFile,
+									   Interval *staleness);
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	Size		size;
+
+	/*
+	 * The sampler and everything built on it keep their state in shared
+	 * memory, which we can only request while being preloaded.  Without that
+	 * only the plain pg_controldata() function is available.
+	 */
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	pgcd_sampler_init();
+	pgcd_alert_init();
+	pgcd_callers_init();
+	pgcd_readahead_init();
+	pgcd_pressure_init();
+	pgcd_walrate_init();
+	pgcd_xidwaste_init();
+
+	EmitWarningsOnPlaceholders("pg_controldata");
+
+	size = pgcd_sampler_shmem_size();
+	size = add_size(size, pgcd_alert_shmem_size());
+	size = add_size(size, pgcd_callers_shmem_size());
+	size = add_size(size, pgcd_startup_shmem_size());
+	size = add_size(size, pgcd_pressure_shmem_size());
+	size = add_size(size, pgcd_walrate_shmem_size());
+	size = add_size(size, pgcd_xidwaste_shmem_size());
+	size = add_size(size, pgcd_results_shmem_size());
+	RequestAddinShmemSpace(size);
+	RequestAddinLWLocks(7);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = pgcd_shmem_startup;
+}
+
+/*
+ * Module unload callback
+ */
+void
+_PG_fini(void)
 {
-	char	   *name;
-	char	   *setting;
-};
+	/* Uninstall hooks. */
+	shmem_startup_hook = prev_shmem_startup_hook;
+}
 
-static struct controldata ControlData[] =
+/*
+ * shmem_startup hook: allocate or attach to shared memory of every module.
+ */
+static void
+pgcd_shmem_startup(void)
 {
-	{"pg_control version number", NULL},
-	{"Catalog version number", NULL},
-	{"Database system identifier", NULL},
-	{"Database cluster state", NULL},
-	{"pg_control last modified", NULL},
-	{"Latest checkpoint location", NULL},
-	{"Prior checkpoint location", NULL},
-	{"Latest checkpoint's REDO location", NULL},
-	{"Latest checkpoint's TimeLineID", NULL},
-	{"Latest checkpoint's NextXID", NULL},
-	{"Latest checkpoint's NextOID", NULL},
-	{"Latest checkpoint's NextMultiXactId", NULL},
-	{"Latest checkpoint's NextMultiOffset", NULL},
-	{"Latest checkpoint's oldestXID", NULL},
-	{"Latest checkpoint's oldestXID's DB", NULL},
-	{"Latest checkpoint's oldestActiveXID", NULL},
-	{"Time of latest checkpoint", NULL},
-	{"Minimum recovery ending location", NULL},
-	{"Backup start location", NULL},
-	{"Maximum data alignment", NULL},
-	{"Database block size", NULL},
-	{"Blocks per segment of large relation", NULL},
-	{"WAL block size", NULL},
-	{"Bytes per WAL segment", NULL},
-	{"Maximum length of identifiers", NULL},
-	{"Maximum columns in an index", NULL},
-	{"Maximum size of a TOAST chunk", NULL},
-	{"Date/time type storage", NULL},
-	{"Float4 argument passing", NULL},
-	{"Float8 argument passing", NULL},
-	{NULL, NULL}
-};
-
-
-static const char *dbState(DBState state);
-static void get_controldata(void);
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	pgcd_sampler_shmem_startup();
+	pgcd_alert_shmem_startup();
+	pgcd_callers_shmem_startup();
+	pgcd_startup_shmem_startup();
+	pgcd_pressure_shmem_startup();
+	pgcd_walrate_shmem_startup();
+	pgcd_xidwaste_shmem_startup();
+	pgcd_results_shmem_startup();
+
+	LWLockRelease(AddinShmemInitLock);
+}
 
 Datum pg_controldata(PG_FUNCTION_ARGS);
 
@@ -104,13 +151,16 @@ pg_controldata(PG_FUNCTION_ARGS)
 {
 	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
 	Tuplestorestate	   *tupstore;
-	HeapTuple			tuple;
 	TupleDesc			tupdesc;
-	AttInMetadata	   *attinmeta;
 	MemoryContext		per_query_ctx;
 	MemoryContext		oldcontext;
-	char			   *values[2];
-	int					i = 0;
+	ControlFileData		ControlFile;
+	Interval			staleness;
+	instr_time			start;
+	instr_time			duration;
+	pgcdCallOutcome		outcome;
+
+	INSTR_TIME_SET_CURRENT(start);
 
 	/* check to see if caller supports us returning a tuplestore */
 	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
@@ -126,41 +176,28 @@ pg_controldata(PG_FUNCTION_ARGS)
 	tupdesc = CreateTupleDescCopy(rsinfo->expectedDesc);
 
 	/*
-	 * Check to make sure we have a reasonable tuple descriptor
+	 * Check to make sure we have a reasonable tuple descriptor.  The
+	 * staleness column is optional, so that installations still using the
+	 * original two-column definition keep working.
 	 */
-	if (tupdesc->natts != 2 ||
+	if (tupdesc->natts < 2 || tupdesc->natts > 3 ||
 		tupdesc->attrs[0]->atttypid != TEXTOID ||
-		tupdesc->attrs[1]->atttypid != TEXTOID)
+		tupdesc->attrs[1]->atttypid != TEXTOID ||
+		(tupdesc->natts == 3 &&
+		 tupdesc->attrs[2]->atttypid != INTERVALOID))
 		ereport(ERROR,
 				(errcode(ERRCODE_SYNTAX_ERROR),
 				 errmsg("query-specified return tuple and "
 						"function return type are not compatible")));
 
-	/* OK to use it */
-	attinmeta = TupleDescGetAttInMetadata(tupdesc);
-
 	/* let the caller know we're sending back a tuplestore */
 	rsinfo->returnMode = SFRM_Materialize;
 
 	/* initialize our tuplestore */
 	tupstore = tuplestore_begin_heap(true, false, work_mem);
 
-	get_controldata();
-	while (ControlData[i].name)
-	{
-		values[0] = ControlData[i].name;
-		values[1] = ControlData[i].setting;
-
-		tuple = BuildTupleFromCStrings(attinmeta, values);
-		tuplestore_puttuple(tupstore, tuple);
-		++i;
-	}
-	
-	/*
-	 * no longer need the tuple descriptor reference created by
-	 * TupleDescGetAttInMetadata()
-	 */
-	ReleaseTupleDesc(tupdesc);
+	outcome = get_controldata(&ControlFile, &staleness);
+	pgcd_results_put(&ControlFile, tupstore, tupdesc, &staleness);
 
 	tuplestore_donestoring(tupstore);
 	rsinfo->setResult = tupstore;
@@ -175,210 +212,64 @@ pg_controldata(PG_FUNCTION_ARGS)
 	rsinfo->setDesc = tupdesc;
 	MemoryContextSwitchTo(oldcontext);
 
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	pgcd_callers_count(outcome, INSTR_TIME_GET_DOUBLE(duration) * 1000.0);
+
 	return (Datum) 0;
 }
 
-static const char *
-dbState(DBState state)
+/*
+ * Read and verify the control file of the cluster at datadir.
+ *
+ * Problems are reported at elevel; if that is less than ERROR we return
+ * false instead, so that callers running on behalf of unrelated queries
+ * (the sampler) can carry on.
+ */
+bool
+pgcd_read_controlfile(const char *datadir, ControlFileData *cf, int elevel)
 {
-	switch (state)
+	char		errbuf[PGCD_ERRBUF_SIZE];
+
+	if (!pgcd_load_controlfile(datadir, cf, errbuf, sizeof(errbuf)))
 	{
-		case DB_STARTUP:
-			return _("starting up");
-		case DB_SHUTDOWNED:
-			return _("shut down");
-		case DB_SHUTDOWNING:
-			return _("shutting down");
-		case DB_IN_CRASH_RECOVERY:
-			return _("in crash recovery");
-		case DB_IN_ARCHIVE_RECOVERY:
-			return _("in archive recovery");
-		case DB_IN_PRODUCTION:
-			return _("in production");
+		elog(elevel, "%s", errbuf);
+		return false;
 	}
-	return _("unrecognized status code");
+
+	return true;
 }
 
 
-static void
-get_controldata(void)
+/*
+ * Fill in ControlFile and set *staleness to the age of the image.
+ *
+ * Callers that have exceeded pg_controldata.min_refresh_interval get the
+ * latest image from shared memory instead of a fresh read.
+ */
+static pgcdCallOutcome
+get_controldata(ControlFileData *ControlFile, Interval *staleness)
 {
-	ControlFileData ControlFile;
-	int				fd;
-	char			ControlFilePath[MAXPGPATH];
-	pg_crc32		crc;
-	time_t			time_tmp;
-	char			pgctime_str[128];
-	char			ckpttime_str[128];
-	char			sysident_str[32];
-	const char	   *strftime_fmt = "%c";
-	StringInfoData	buf;
-
-	snprintf(ControlFilePath, MAXPGPATH, "%s/global/pg_control", DataDir);
-
-	if ((fd = open(ControlFilePath, O_RDONLY | PG_BINARY, 0)) == -1)
-		elog(ERROR, "could not open file \"%s\" for reading: %s",
-					 ControlFilePath, strerror(errno));
-
-	if (read(fd, &ControlFile, sizeof(ControlFileData)) != sizeof(ControlFileData))
-		elog(ERROR, "could not read file \"%s\": %s",
-					 ControlFilePath, strerror(errno));
-
-	close(fd);
-
-	/* Check the CRC. */
-	INIT_CRC32(crc);
-	COMP_CRC32(crc,
-			   (char *) &ControlFile,
-			   offsetof(ControlFileData, crc));
-	FIN_CRC32(crc);
-
-	if (!EQ_CRC32(crc, ControlFile.crc))
-		elog(ERROR, "calculated CRC checksum does not match value stored in file");
-
-	/*
-	 * This slightly-chintzy coding will work as long as the control file
-	 * timestamps are within the range of time_t; that should be the case in
-	 * all foreseeable circumstances, so we don't bother importing the
-	 * backend's timezone library.
-	 *
-	 * Use variable for format to suppress overly-anal-retentive gcc warning
-	 * about %c
-	 */
-	time_tmp = (time_t) ControlFile.time;
-	strftime(pgctime_str, sizeof(pgctime_str), strftime_fmt,
-			 localtime(&time_tmp));
-	time_tmp = (time_t) ControlFile.checkPointCopy.time;
-	strftime(ckpttime_str, sizeof(ckpttime_str), strftime_fmt,
-			 localtime(&time_tmp));
-
-	/*
-	 * Format system_identifier separately to keep platform-dependent format
-	 * code out of the message string.
-	 */
-	snprintf(sysident_str, sizeof(sysident_str), UINT64_FORMAT,
-			 ControlFile.system_identifier);
-
-
-	initStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.pg_control_version);
-	ControlData[0].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.catalog_version_no);
-	ControlData[1].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%s", sysident_str);
-	ControlData[2].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%s", dbState(ControlFile.state));
-	ControlData[3].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%s", pgctime_str);
-	ControlData[4].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%X/%X", ControlFile.checkPoint.xlogid, ControlFile.checkPoint.xrecoff);
-	ControlData[5].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%X/%X", ControlFile.prevCheckPoint.xlogid, ControlFile.prevCheckPoint.xrecoff);
-	ControlData[6].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%X/%X", ControlFile.checkPointCopy.redo.xlogid, ControlFile.checkPointCopy.redo.xrecoff);
-	ControlData[7].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.checkPointCopy.ThisTimeLineID);
-	ControlData[8].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u/%u", ControlFile.checkPointCopy.nextXidEpoch, ControlFile.checkPointCopy.nextXid);
-	ControlData[9].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.checkPointCopy.nextOid);
-	ControlData[10].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.checkPointCopy.nextMulti);
-	ControlData[11].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.checkPointCopy.nextMultiOffset);
-	ControlData[12].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.checkPointCopy.oldestXid);
-	ControlData[13].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.checkPointCopy.oldestXidDB);
-	ControlData[14].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.checkPointCopy.oldestActiveXid);
-	ControlData[15].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%s", ckpttime_str);
-	ControlData[16].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%X/%X", ControlFile.minRecoveryPoint.xlogid, ControlFile.minRecoveryPoint.xrecoff);
-	ControlData[17].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%X/%X", ControlFile.backupStartPoint.xlogid, ControlFile.backupStartPoint.xrecoff);
-	ControlData[18].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.maxAlign);
-	ControlData[19].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.blcksz);
-	ControlData[20].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.relseg_size);
-	ControlData[21].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.xlog_blcksz);
-	ControlData[22].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.xlog_seg_size);
-	ControlData[23].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.nameDataLen);
-	ControlData[24].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.indexMaxKeys);
-	ControlData[25].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
-
-	appendStringInfo(&buf, "%u", ControlFile.toast_max_chunk_size);
-	ControlData[26].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
+	pgcdCallOutcome	outcome = PGCD_OUTCOME_CHANGED;
+	TimestampTz		now = GetCurrentTimestamp();
+	TimestampTz		confirmed = now;
+
+	if (pgcd && pgcd_callers_throttled(now) &&
+		pgcd_latest(ControlFile, &confirmed))
+		outcome = PGCD_OUTCOME_CACHED;
+	else
+	{
+		pgcd_read_controlfile(DataDir, ControlFile, ERROR);
 
-	appendStringInfo(&buf, "%s", (ControlFile.enableIntTimes ? "64-bit integers" : "floating-point numbers"));
-	ControlData[27].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
+		/* Feed the sampler while we have a fresh image at hand. */
+		if (pgcd && !pgcd_observe(ControlFile, now))
+			outcome = PGCD_OUTCOME_UNCHANGED;
+	}
 
-	appendStringInfo(&buf, "%s", (ControlFile.float4ByVal ? "by value" : "by reference"));
-	ControlData[28].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
+	/* in the units of the timestamps, like timestamp_mi() */
+	staleness->time = now - confirmed;
+	staleness->day = 0;
+	staleness->month = 0;
 
-	appendStringInfo(&buf, "%s", (ControlFile.float8ByVal ? "by value" : "by reference"));
-	ControlData[29].setting = pstrdup(buf.data);
-	resetStringInfo(&buf);
+	return outcome;
 }
@@ -0,0 +1,182 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_controldata.h
+ *		Declarations shared by the pg_controldata modules.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+#ifndef PG_CONTROLDATA_H
+#define PG_CONTROLDATA_H
+
+#include "storage/lwlock.h"
+#include "storage/spin.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#include "pgcd_common.h"
+
+/*
+ * One control file image as seen by the sampler.
+ */
+typedef struct pgcdSnapshot
+{
+	TimestampTz		observed;		/* when the sampler read this image */
+	ControlFileData	control;
+} pgcdSnapshot;
+
+/*
+ * How a pg_controldata() call got its data, for per-caller accounting.
+ */
+typedef enum pgcdCallOutcome
+{
+	PGCD_OUTCOME_CHANGED,		/* read pg_control and found a new image */
+	PGCD_OUTCOME_UNCHANGED,		/* read pg_control, same image as before */
+	PGCD_OUTCOME_CACHED,		/* rate limited, served the shared copy */
+	PGCD_NUM_OUTCOMES
+} pgcdCallOutcome;
+
+/*
+ * Least-squares regression of y (a position or counter) on x (seconds),
+ * also stored as the bytea state of pg_controldata_rate(); the slope is
+ * sxy / sxx.
+ */
+typedef struct pgcdRegrState
+{
+	int32		vl_len_;		/* varlena header (do not touch directly!) */
+	int64		n;
+	double		mean_x;
+	double		mean_y;
+	double		sxx;			/* sum of squared deviations of x */
+	double		sxy;			/* co-moment of x and y */
+	int64		min_y;
+	int64		max_y;
+} pgcdRegrState;
+
+/* number of columns produced by pgcd_snapshot_values() */
+#define PGCD_SNAPSHOT_COLS	17
+
+/*
+ * Global shared state.  Snapshot number n (counting from zero since
+ * postmaster start) lives in ring[n % history_size]; only the most recent
+ * history_size of them are retained.
+ */
+typedef struct pgcdSharedState
+{
+	LWLockId		lock;			/* protects everything but last_sample */
+	slock_t			mutex;			/* protects last_sample */
+	TimestampTz		last_sample;	/* last time anybody read pg_control */
+	TimestampTz		confirmed;		/* last time the latest image was read */
+	uint64			nsnapshots;		/* snapshots ever recorded */
+	uint64			nflushed;		/* snapshots written to history_table */
+	int				flush_pid;		/* backend with a flush in flight, or 0 */
+	uint64			flush_upto;		/* nsnapshots covered by that flush */
+	int				history_size;	/* allocated entries in ring[] */
+	pgcdSnapshot	ring[1];		/* VARIABLE LENGTH ARRAY */
+} pgcdSharedState;
+
+/* GUC variables */
+extern int	pgcd_history_size;
+extern int	pgcd_sample_interval;
+extern char *pgcd_history_table;
+extern int	pgcd_history_batch;
+extern int	pgcd_history_retention;
+extern char *pgcd_checkpoint_table;
+
+/* shared state, or NULL when not loaded via shared_preload_libraries */
+extern pgcdSharedState *pgcd;
+
+/* pg_controldata.c */
+extern bool pgcd_read_controlfile(const char *datadir, ControlFileData *cf,
+								  int elevel);
+
+/* pgcd_sampler.c */
+extern void pgcd_sampler_init(void);
+extern Size pgcd_sampler_shmem_size(void);
+extern void pgcd_sampler_shmem_startup(void);
+extern bool pgcd_observe(const ControlFileData *cf, TimestampTz now);
+extern bool pgcd_latest(ControlFileData *cf, TimestampTz *confirmed);
+extern void pgcd_maybe_sample(void);
+extern int	pgcd_history_copy(pgcdSnapshot **result);
+extern int	pgcd_history_checkpoints(pgcdSnapshot **result);
+extern void pgcd_snapshot_values(const pgcdSnapshot *snap,
+								 Datum *values, bool *nulls);
+
+/* pgcd_alert.c */
+extern int	pgcd_max_alert_rules;
+extern void pgcd_alert_init(void);
+extern Size pgcd_alert_shmem_size(void);
+extern void pgcd_alert_shmem_startup(void);
+extern void pgcd_alert_evaluate(const ControlFileData *cf, TimestampTz now);
+
+/* pgcd_callers.c */
+extern int	pgcd_max_callers;
+extern int	pgcd_min_refresh_interval;
+extern void pgcd_callers_init(void);
+extern Size pgcd_callers_shmem_size(void);
+extern void pgcd_callers_shmem_startup(void);
+extern void pgcd_callers_count(pgcdCallOutcome outcome, double msec);
+extern bool pgcd_callers_throttled(TimestampTz now);
+
+/* pgcd_readahead.c */
+extern int	pgcd_recovery_readahead;
+extern void pgcd_readahead_init(void);
+extern int64 pgcd_readahead_wal(TimeLineID tli, XLogRecPtr redo);
+
+/* pgcd_pressure.c */
+extern int	pgcd_pressure_samples;
+extern void pgcd_pressure_init(void);
+extern Size pgcd_pressure_shmem_size(void);
+extern void pgcd_pressure_shmem_startup(void);
+extern void pgcd_pressure_sample(TimestampTz now);
+
+/* pgcd_walrate.c */
+extern int	pgcd_wal_samples;
+extern int	pgcd_wal_sample_interval;
+extern void pgcd_walrate_init(void);
+extern Size pgcd_walrate_shmem_size(void);
+extern void pgcd_walrate_shmem_startup(void);
+extern void pgcd_walrate_maybe_sample(void);
+
+/* pgcd_xidwaste.c */
+extern int	pgcd_xact_checkpoints;
+extern int	pgcd_xact_databases;
+extern void pgcd_xidwaste_init(void);
+extern Size pgcd_xidwaste_shmem_size(void);
+extern void pgcd_xidwaste_shmem_startup(void);
+extern void pgcd_xidwaste_observe(const ControlFileData *cf);
+
+/* pgcd_results.c */
+extern Size pgcd_results_shmem_size(void);
+extern void pgcd_results_shmem_startup(void);
+extern void pgcd_results_put(const ControlFileData *cf,
+							 Tuplestorestate *tupstore, TupleDesc tupdesc,
+							 const Interval *staleness);
+
+/* pgcd_aggregates.c */
+extern void pgcd_regr_add(pgcdRegrState *state, double x, int64 y);
+
+/* pgcd_startup.c */
+extern Size pgcd_startup_shmem_size(void);
+extern void pgcd_startup_shmem_startup(void);
+extern void pgcd_startup_observe(const ControlFileData *cf);
+
+#endif   /* PG_CONTROLDATA_H */
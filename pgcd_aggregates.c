@@ -0,0 +1,364 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_aggregates.c
+ *		Aggregates over stored control file snapshots.
+ *
+ * The built-in sum(bigint) and regr_slope() go through numeric or make the
+ * caller convert positions and timestamps first.  The regression state
+ * here is a small fixed-size bytea, updated in place: positions or 64-bit
+ * XIDs against time, kept with Welford's running means and co-moments so
+ * that epoch-sized timestamps lose no precision.
+ *
+ * PostgreSQL 9.0 cannot run an aggregate in parallel, but since the state
+ * is plain bytea, a rollup can be split by hand: compute
+ * pg_controldata_regr_state() per shard or partition, combine the partial
+ * states with pg_controldata_regr_combine(), and finish with
+ * pg_controldata_regr_rate() or pg_controldata_regr_span().
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "fmgr.h"
+#include "utils/memutils.h"
+
+#include "pg_controldata.h"
+
+
+#define REGR_STATE_SIZE		sizeof(pgcdRegrState)
+
+/*
+ * Values collected for a percentile, in the aggregate's memory context.
+ * All of them are kept, so a group can have at most 2^26 values, the most
+ * one allocation can hold after doubling, and partial states cannot be
+ * combined.
+ */
+typedef struct pgcdPercentileState
+{
+	double		fraction;
+	int			nvalues;
+	int			nalloc;
+	double	   *values;
+} pgcdPercentileState;
+
+static pgcdRegrState *regr_state_arg(FunctionCallInfo fcinfo,
+									 MemoryContext aggcontext);
+static pgcdRegrState *regr_state_copy(const bytea *src);
+static int	double_cmp(const void *a, const void *b);
+
+Datum		pg_controldata_regr_accum(PG_FUNCTION_ARGS);
+Datum		pg_controldata_regr_merge(PG_FUNCTION_ARGS);
+Datum		pg_controldata_regr_rate(PG_FUNCTION_ARGS);
+Datum		pg_controldata_regr_span(PG_FUNCTION_ARGS);
+Datum		pg_controldata_percentile_accum(PG_FUNCTION_ARGS);
+Datum		pg_controldata_percentile_final(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_regr_accum);
+PG_FUNCTION_INFO_V1(pg_controldata_regr_merge);
+PG_FUNCTION_INFO_V1(pg_controldata_regr_rate);
+PG_FUNCTION_INFO_V1(pg_controldata_regr_span);
+PG_FUNCTION_INFO_V1(pg_controldata_percentile_accum);
+PG_FUNCTION_INFO_V1(pg_controldata_percentile_final);
+
+
+/*
+ * The transition state in argument 0, writable: inside an aggregate we may
+ * scribble on it, otherwise we work on a copy.  A NULL state starts empty.
+ */
+static pgcdRegrState *
+regr_state_arg(FunctionCallInfo fcinfo, MemoryContext aggcontext)
+{
+	pgcdRegrState *state;
+	bytea	   *src;
+
+	if (PG_ARGISNULL(0))
+	{
+		state = (pgcdRegrState *) MemoryContextAllocZero(aggcontext,
+														 REGR_STATE_SIZE);
+		SET_VARSIZE(state, REGR_STATE_SIZE);
+		return state;
+	}
+
+	src = PG_GETARG_BYTEA_P(0);
+
+	/* our own state from the previous row */
+	if (AggCheckCallContext(fcinfo, NULL))
+		return (pgcdRegrState *) src;
+
+	return regr_state_copy(src);
+}
+
+/*
+ * Check a stored state and copy it to aligned memory; bytea columns are
+ * only int-aligned.
+ */
+static pgcdRegrState *
+regr_state_copy(const bytea *src)
+{
+	pgcdRegrState *state;
+
+	if (VARSIZE(src) != REGR_STATE_SIZE)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid pg_controldata regression state")));
+
+	state = (pgcdRegrState *) palloc(REGR_STATE_SIZE);
+	memcpy(state, src, REGR_STATE_SIZE);
+	return state;
+}
+
+/*
+ * Add the point (x, y) to a regression state.
+ */
+void
+pgcd_regr_add(pgcdRegrState *state, double x, int64 y)
+{
+	double		dx;
+
+	if (state->n == 0)
+		state->min_y = state->max_y = y;
+	else
+	{
+		state->min_y = Min(state->min_y, y);
+		state->max_y = Max(state->max_y, y);
+	}
+
+	state->n++;
+	dx = x - state->mean_x;
+	state->mean_x += dx / state->n;
+	state->mean_y += (y - state->mean_y) / state->n;
+	state->sxx += dx * (x - state->mean_x);
+	state->sxy += dx * (y - state->mean_y);
+}
+
+/*
+ * Add the pair (y, t) to the state; NULLs are ignored.
+ */
+Datum
+pg_controldata_regr_accum(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	pgcdRegrState *state;
+	int64		y;
+	double		x;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		aggcontext = CurrentMemoryContext;
+
+	state = regr_state_arg(fcinfo, aggcontext);
+
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		PG_RETURN_POINTER(state);
+
+	y = PG_GETARG_INT64(1);
+	x = (double) PG_GETARG_TIMESTAMPTZ(2);
+#ifdef HAVE_INT64_TIMESTAMP
+	x /= USECS_PER_SEC;
+#endif
+
+	pgcd_regr_add(state, x, y);
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Fold the partial state in argument 1 into the state.
+ */
+Datum
+pg_controldata_regr_merge(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	pgcdRegrState *state;
+	pgcdRegrState *other;
+	double		n;
+	double		dx;
+	double		dy;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		aggcontext = CurrentMemoryContext;
+
+	state = regr_state_arg(fcinfo, aggcontext);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	other = regr_state_copy(PG_GETARG_BYTEA_P(1));
+
+	if (other->n == 0)
+		PG_RETURN_POINTER(state);
+	if (state->n == 0)
+	{
+		memcpy(state, other, REGR_STATE_SIZE);
+		PG_RETURN_POINTER(state);
+	}
+
+	/* Chan et al.'s pairwise update */
+	n = (double) state->n + other->n;
+	dx = other->mean_x - state->mean_x;
+	dy = other->mean_y - state->mean_y;
+
+	state->sxx += other->sxx + dx * dx * state->n * other->n / n;
+	state->sxy += other->sxy + dx * dy * state->n * other->n / n;
+	state->mean_x += dx * other->n / n;
+	state->mean_y += dy * other->n / n;
+	state->n += other->n;
+	state->min_y = Min(state->min_y, other->min_y);
+	state->max_y = Max(state->max_y, other->max_y);
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Least-squares slope in units per second; NULL for fewer than two
+ * distinct times.
+ */
+Datum
+pg_controldata_regr_rate(PG_FUNCTION_ARGS)
+{
+	pgcdRegrState *state;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = regr_state_copy(PG_GETARG_BYTEA_P(0));
+
+	if (state->n < 2 || state->sxx <= 0)
+		PG_RETURN_NULL();
+
+	PG_RETURN_FLOAT8(state->sxy / state->sxx);
+}
+
+/*
+ * Distance between the smallest and largest y, e.g. the WAL written.
+ */
+Datum
+pg_controldata_regr_span(PG_FUNCTION_ARGS)
+{
+	pgcdRegrState *state;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = regr_state_copy(PG_GETARG_BYTEA_P(0));
+
+	if (state->n == 0)
+		PG_RETURN_NULL();
+
+	PG_RETURN_INT64(state->max_y - state->min_y);
+}
+
+/*
+ * Collect a value for pg_controldata_percentile(value, fraction).  The
+ * fraction of the first row counts.
+ */
+Datum
+pg_controldata_percentile_accum(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	pgcdPercentileState *state;
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		elog(ERROR, "pg_controldata_percentile_accum called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+	{
+		double		fraction;
+
+		if (PG_ARGISNULL(2))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("percentile fraction must not be null")));
+		fraction = PG_GETARG_FLOAT8(2);
+		if (fraction < 0 || fraction > 1 || isnan(fraction))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("percentile fraction %g is not between 0 and 1",
+							fraction)));
+
+		state = (pgcdPercentileState *)
+			MemoryContextAlloc(aggcontext, sizeof(pgcdPercentileState));
+		state->fraction = fraction;
+		state->nvalues = 0;
+		state->nalloc = 64;
+		state->values = (double *)
+			MemoryContextAlloc(aggcontext, state->nalloc * sizeof(double));
+	}
+	else
+		state = (pgcdPercentileState *) PG_GETARG_POINTER(0);
+
+	if (!PG_ARGISNULL(1))
+	{
+		if (state->nvalues >= state->nalloc)
+		{
+			if (state->nalloc >= MaxAllocSize / sizeof(double) / 2)
+				ereport(ERROR,
+						(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						 errmsg("too many values for pg_controldata_percentile"),
+						 errdetail("At most %d values can be kept for one group.",
+								   state->nalloc)));
+			state->nalloc *= 2;
+			state->values = (double *)
+				repalloc(state->values, state->nalloc * sizeof(double));
+		}
+		state->values[state->nvalues++] = PG_GETARG_FLOAT8(1);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+static int
+double_cmp(const void *a, const void *b)
+{
+	double		da = *(const double *) a;
+	double		db = *(const double *) b;
+
+	if (da < db)
+		return -1;
+	if (da > db)
+		return 1;
+	return 0;
+}
+
+/*
+ * Nearest-rank percentile of the collected values.
+ */
+Datum
+pg_controldata_percentile_final(PG_FUNCTION_ARGS)
+{
+	pgcdPercentileState *state;
+	int			rank;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	state = (pgcdPercentileState *) PG_GETARG_POINTER(0);
+	if (state->nvalues == 0)
+		PG_RETURN_NULL();
+
+	qsort(state->values, state->nvalues, sizeof(double), double_cmp);
+
+	rank = (int) ceil(state->fraction * state->nvalues);
+	PG_RETURN_FLOAT8(state->values[Max(rank, 1) - 1]);
+}
@@ -0,0 +1,530 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_alert.c
+ *		Threshold alerts over control file metrics, evaluated by the
+ *		sampler.
+ *
+ * Rules live in the pg_controldata_alert_rule table and are copied into
+ * shared memory by pg_controldata_alert_reload(), so that the sampler can
+ * check them against every pg_control read without touching the catalogs,
+ * whatever database it happens to be running in.
+ *
+ * A rule is raised when its metric exceeds raise_above and cleared when it
+ * falls below clear_below; in between it keeps its previous state.  Once
+ * a rule has changed state, further changes are held back for its
+ * cooldown.  Only state changes are reported, either to the server log or
+ * by NOTIFY.  Notifications can only be sent from the database the rules
+ * were loaded from, so they stay pending until a backend connected there
+ * samples outside a transaction block (one that might be prepared, which
+ * a NOTIFY would prevent), and are only considered delivered once the
+ * subtransaction that queued them and then its transaction commit.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "commands/async.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+
+#include "pg_controldata.h"
+
+
+/* metrics a rule can watch */
+typedef enum pgcdAlertMetric
+{
+	PGCD_METRIC_XID_AGE,			/* NextXID - oldestXID */
+	PGCD_METRIC_CHECKPOINT_AGE,		/* seconds since latest checkpoint */
+	PGCD_METRIC_NOT_IN_PRODUCTION,	/* 1 unless state is "in production" */
+	PGCD_METRIC_REDO_DISTANCE		/* WAL bytes from redo to insert point */
+} pgcdAlertMetric;
+
+static const char *const metric_names[] =
+{
+	"xid_age",
+	"checkpoint_age",
+	"not_in_production",
+	"redo_distance"
+};
+
+#define NUM_METRICS		lengthof(metric_names)
+
+typedef struct pgcdAlertRule
+{
+	/* definition, from pg_controldata_alert_rule */
+	char			name[NAMEDATALEN];
+	pgcdAlertMetric	metric;
+	double			raise_above;
+	double			clear_below;
+	int64			cooldown;		/* microseconds */
+	bool			notify;			/* NOTIFY rather than LOG */
+	char			channel[NAMEDATALEN];
+
+	/* state */
+	bool			firing;
+	double			value;			/* as of the latest evaluation */
+	TimestampTz		changed;		/* last state change, or 0 */
+	bool			notify_pending;	/* state change not yet NOTIFYed */
+	int				notify_pid;		/* backend sending it, or 0 */
+	SubTransactionId notify_subid;	/* ... and its subtransaction */
+} pgcdAlertRule;
+
+typedef struct pgcdAlertState
+{
+	LWLockId		lock;
+	Oid				dboid;			/* database the rules came from */
+	int				nrules;
+	pgcdAlertRule	rules[1];		/* VARIABLE LENGTH ARRAY */
+} pgcdAlertState;
+
+/* GUC variables */
+int			pgcd_max_alert_rules;
+
+static pgcdAlertState *alerts = NULL;
+
+/* true if this backend has queued a NOTIFY for some rule */
+static bool notify_in_flight = false;
+
+static double metric_value(pgcdAlertMetric metric, const ControlFileData *cf,
+			 TimestampTz now, bool *valid);
+static void alert_payload(const pgcdAlertRule *rule, char *buf, int len);
+static void pgcd_alert_xact_callback(XactEvent event, void *arg);
+static void pgcd_alert_subxact_callback(SubXactEvent event,
+										SubTransactionId mySubid,
+										SubTransactionId parentSubid,
+										void *arg);
+
+Datum		pg_controldata_alert_reload(PG_FUNCTION_ARGS);
+Datum		pg_controldata_alerts(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_alert_reload);
+PG_FUNCTION_INFO_V1(pg_controldata_alerts);
+
+
+/*
+ * Define GUCs; called from _PG_init.
+ */
+void
+pgcd_alert_init(void)
+{
+	DefineCustomIntVariable("pg_controldata.max_alert_rules",
+			"Sets the maximum number of alert rules kept in shared memory.",
+							NULL,
+							&pgcd_max_alert_rules,
+							32,
+							0,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL);
+
+	RegisterXactCallback(pgcd_alert_xact_callback, NULL);
+	RegisterSubXactCallback(pgcd_alert_subxact_callback, NULL);
+}
+
+Size
+pgcd_alert_shmem_size(void)
+{
+	Size		size;
+
+	size = offsetof(pgcdAlertState, rules);
+	size = add_size(size, mul_size(pgcd_max_alert_rules,
+								   sizeof(pgcdAlertRule)));
+
+	return size;
+}
+
+void
+pgcd_alert_shmem_startup(void)
+{
+	bool		found;
+
+	alerts = ShmemInitStruct("pg_controldata alerts",
+							 pgcd_alert_shmem_size(),
+							 &found);
+
+	if (!found)
+	{
+		alerts->lock = LWLockAssign();
+		alerts->dboid = InvalidOid;
+		alerts->nrules = 0;
+	}
+}
+
+static double
+metric_value(pgcdAlertMetric metric, const ControlFileData *cf,
+			 TimestampTz now, bool *valid)
+{
+	const CheckPoint *ckpt = &cf->checkPointCopy;
+
+	*valid = true;
+
+	switch (metric)
+	{
+		case PGCD_METRIC_XID_AGE:
+			return (double) (uint32) (ckpt->nextXid - ckpt->oldestXid);
+
+		case PGCD_METRIC_CHECKPOINT_AGE:
+			{
+				long		secs;
+				int			usecs;
+
+				TimestampDifference(time_t_to_timestamptz(ckpt->time), now,
+									&secs, &usecs);
+				return (double) secs + usecs / 1000000.0;
+			}
+
+		case PGCD_METRIC_NOT_IN_PRODUCTION:
+			return (cf->state == DB_IN_PRODUCTION) ? 0.0 : 1.0;
+
+		case PGCD_METRIC_REDO_DISTANCE:
+			/* there is no insert position to speak of during recovery */
+			if (RecoveryInProgress())
+				break;
+			return (double) (PGCD_LSN_POS(GetInsertRecPtr()) -
+							 PGCD_LSN_POS(ckpt->redo));
+	}
+
+	*valid = false;
+	return 0.0;
+}
+
+static void
+alert_payload(const pgcdAlertRule *rule, char *buf, int len)
+{
+	snprintf(buf, len, "%s %s %s=%g",
+			 rule->name, rule->firing ? "raised" : "cleared",
+			 metric_names[rule->metric], rule->value);
+}
+
+/*
+ * Evaluate all rules against a freshly read control file.
+ *
+ * Called by the sampler after every successful read of pg_control; this is
+ * also where pending notifications get sent, when we're in the right
+ * database.
+ */
+void
+pgcd_alert_evaluate(const ControlFileData *cf, TimestampTz now)
+{
+	pgcdAlertRule *copies;
+	int			nchanged = 0;
+	bool		can_notify;
+	int			i;
+
+	if (!alerts || alerts->nrules == 0)
+		return;
+
+	can_notify = (MyDatabaseId == alerts->dboid && !RecoveryInProgress() &&
+				  !IsTransactionBlock());
+
+	/* room for every rule to change; nrules may grow until we lock */
+	copies = (pgcdAlertRule *) palloc(pgcd_max_alert_rules *
+									  sizeof(pgcdAlertRule));
+
+	LWLockAcquire(alerts->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < alerts->nrules; i++)
+	{
+		pgcdAlertRule *rule = &alerts->rules[i];
+		bool		valid;
+		bool		firing;
+
+		rule->value = metric_value(rule->metric, cf, now, &valid);
+		if (!valid)
+			continue;
+
+		if (rule->value > rule->raise_above)
+			firing = true;
+		else if (rule->value < rule->clear_below)
+			firing = false;
+		else
+			firing = rule->firing;
+
+		if (firing != rule->firing &&
+			(rule->changed == 0 ||
+			 now - rule->changed >= rule->cooldown))
+		{
+			rule->firing = firing;
+			rule->changed = now;
+			if (rule->notify)
+				rule->notify_pending = true;
+			else
+				copies[nchanged++] = *rule;
+		}
+
+		if (can_notify && rule->notify_pending && rule->notify_pid == 0)
+		{
+			char		payload[NAMEDATALEN * 2 + 64];
+
+			alert_payload(rule, payload, sizeof(payload));
+			Async_Notify(rule->channel, payload);
+			rule->notify_pid = MyProcPid;
+			rule->notify_subid = GetCurrentSubTransactionId();
+			notify_in_flight = true;
+		}
+	}
+
+	LWLockRelease(alerts->lock);
+
+	for (i = 0; i < nchanged; i++)
+	{
+		if (copies[i].firing)
+			ereport(LOG,
+					(errmsg("pg_controldata alert \"%s\" raised: %s is %g, above %g",
+							copies[i].name, metric_names[copies[i].metric],
+							copies[i].value, copies[i].raise_above)));
+		else
+			ereport(LOG,
+					(errmsg("pg_controldata alert \"%s\" cleared: %s is %g, below %g",
+							copies[i].name, metric_names[copies[i].metric],
+							copies[i].value, copies[i].clear_below)));
+	}
+
+	pfree(copies);
+}
+
+static void
+pgcd_alert_xact_callback(XactEvent event, void *arg)
+{
+	int			i;
+
+	if (!notify_in_flight)
+		return;
+	notify_in_flight = false;
+
+	LWLockAcquire(alerts->lock, LW_EXCLUSIVE);
+	for (i = 0; i < alerts->nrules; i++)
+	{
+		pgcdAlertRule *rule = &alerts->rules[i];
+
+		if (rule->notify_pid != MyProcPid)
+			continue;
+		if (event == XACT_EVENT_COMMIT)
+			rule->notify_pending = false;
+		rule->notify_pid = 0;
+	}
+	LWLockRelease(alerts->lock);
+}
+
+/*
+ * A NOTIFY queued in a subtransaction is dropped if that aborts, and
+ * belongs to its parent once it commits.
+ */
+static void
+pgcd_alert_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+							SubTransactionId parentSubid, void *arg)
+{
+	int			i;
+
+	if (!notify_in_flight || event == SUBXACT_EVENT_START_SUB)
+		return;
+
+	LWLockAcquire(alerts->lock, LW_EXCLUSIVE);
+	for (i = 0; i < alerts->nrules; i++)
+	{
+		pgcdAlertRule *rule = &alerts->rules[i];
+
+		if (rule->notify_pid != MyProcPid || rule->notify_subid != mySubid)
+			continue;
+		if (event == SUBXACT_EVENT_COMMIT_SUB)
+			rule->notify_subid = parentSubid;
+		else
+			rule->notify_pid = 0;
+	}
+	LWLockRelease(alerts->lock);
+}
+
+/*
+ * Copy pg_controldata_alert_rule into shared memory.
+ *
+ * Rules keep their state across a reload as long as their name and metric
+ * stay the same.
+ */
+Datum
+pg_controldata_alert_reload(PG_FUNCTION_ARGS)
+{
+	pgcdAlertRule *newrules;
+	int			nrules;
+	int			i;
+	int			j;
+
+	if (!alerts)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (SPI_execute("SELECT name, metric, raise_above, clear_below, "
+					"extract(epoch FROM cooldown)::float8, "
+					"action = 'notify', channel "
+					"FROM pg_controldata_alert_rule ORDER BY name",
+					true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not read pg_controldata_alert_rule");
+
+	if (SPI_processed > (uint32) pgcd_max_alert_rules)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many alert rules: %u", SPI_processed),
+				 errhint("Increase pg_controldata.max_alert_rules.")));
+
+	nrules = SPI_processed;
+	newrules = (pgcdAlertRule *) palloc0(Max(nrules, 1) * sizeof(pgcdAlertRule));
+
+	for (i = 0; i < nrules; i++)
+	{
+		HeapTuple	tup = SPI_tuptable->vals[i];
+		TupleDesc	desc = SPI_tuptable->tupdesc;
+		pgcdAlertRule *rule = &newrules[i];
+		char	   *metric;
+		bool		isnull;
+
+		strlcpy(rule->name, SPI_getvalue(tup, desc, 1), NAMEDATALEN);
+
+		metric = SPI_getvalue(tup, desc, 2);
+		for (j = 0; j < NUM_METRICS; j++)
+			if (strcmp(metric, metric_names[j]) == 0)
+				break;
+		if (j == NUM_METRICS)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("unrecognized metric \"%s\" in alert rule \"%s\"",
+							metric, rule->name)));
+		rule->metric = (pgcdAlertMetric) j;
+
+		rule->raise_above = DatumGetFloat8(SPI_getbinval(tup, desc, 3, &isnull));
+		rule->clear_below = DatumGetFloat8(SPI_getbinval(tup, desc, 4, &isnull));
+		rule->cooldown = (int64) (DatumGetFloat8(SPI_getbinval(tup, desc, 5, &isnull))
+								  * USECS_PER_SEC);
+		rule->notify = DatumGetBool(SPI_getbinval(tup, desc, 6, &isnull));
+		strlcpy(rule->channel, SPI_getvalue(tup, desc, 7), NAMEDATALEN);
+	}
+
+	SPI_finish();
+
+	LWLockAcquire(alerts->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < nrules; i++)
+	{
+		for (j = 0; j < alerts->nrules; j++)
+		{
+			pgcdAlertRule *old = &alerts->rules[j];
+
+			if (strcmp(old->name, newrules[i].name) == 0 &&
+				old->metric == newrules[i].metric)
+			{
+				newrules[i].firing = old->firing;
+				newrules[i].value = old->value;
+				newrules[i].changed = old->changed;
+				break;
+			}
+		}
+	}
+
+	memcpy(alerts->rules, newrules, nrules * sizeof(pgcdAlertRule));
+	alerts->nrules = nrules;
+	alerts->dboid = MyDatabaseId;
+
+	LWLockRelease(alerts->lock);
+
+	PG_RETURN_INT32(nrules);
+}
+
+/*
+ * Show the loaded rules and their current state.
+ */
+Datum
+pg_controldata_alerts(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	int					i;
+
+	if (!alerts)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(alerts->lock, LW_SHARED);
+
+	for (i = 0; i < alerts->nrules; i++)
+	{
+		pgcdAlertRule *rule = &alerts->rules[i];
+		Datum		values[6];
+		bool		nulls[6];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(rule->name);
+		values[1] = CStringGetTextDatum(metric_names[rule->metric]);
+		values[2] = Float8GetDatum(rule->value);
+		values[3] = BoolGetDatum(rule->firing);
+		if (rule->changed != 0)
+			values[4] = TimestampTzGetDatum(rule->changed);
+		else
+			nulls[4] = true;
+		values[5] = BoolGetDatum(rule->notify_pending);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	LWLockRelease(alerts->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
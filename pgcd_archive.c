@@ -0,0 +1,396 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_archive.c
+ *		Check that a WAL archive can start recovery from a cluster's latest
+ *		checkpoint.
+ *
+ * From pg_control we know the segment and offset of the checkpoint's REDO
+ * location and of the checkpoint record itself.  Rather than decompressing
+ * whole archived segments, we stream them from the start only as far as
+ * needed: the long page header of each segment, the page holding the REDO
+ * location and the pages holding the checkpoint record, which must match
+ * the copy in pg_control.  Records are reassembled by the WAL reader in
+ * pgcd_common.c.  Memory use is one WAL page and one checkpoint record,
+ * plus zlib's window, however far into the segment we read.
+ *
+ * Archived segments are looked for as "NAME.gz" and then as plain "NAME";
+ * gzread() reads uncompressed files unchanged.  Without zlib only plain
+ * segments can be read.
+ *
+ * Like pgcd_common.c, this file is compiled both into the server module and
+ * into the programs under tools/, and must not ereport or palloc.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#ifdef FRONTEND
+#include "postgres_fe.h"
+#else
+#include "postgres.h"
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "access/rmgr.h"
+
+#include "pgcd_common.h"
+
+
+/* a checkpoint record, header included */
+#define CHECKPOINT_RECORD_LEN	(SizeOfXLogRecord + sizeof(CheckPoint))
+
+/*
+ * One archived segment, read front to back.
+ */
+typedef struct archive_reader
+{
+	const char *archive_dir;
+	const ControlFileData *cf;
+	TimeLineID	tli;
+	pgcdArchiveCheck *result;
+#ifdef HAVE_LIBZ
+	gzFile		gz;
+#else
+	int			fd;
+#endif
+	bool		open;
+	uint32		log;			/* segment currently open */
+	uint32		seg;
+	uint32		next;			/* offset of the next page to read in it */
+	char	   *page;			/* where the WAL reader wants the page */
+	char	   *errbuf;			/* ... and the error message */
+	size_t		errlen;
+} archive_reader;
+
+static bool open_segment(archive_reader *r, uint32 log, uint32 seg);
+static void close_segment(archive_reader *r);
+static bool read_next_page(archive_reader *r);
+static bool read_archive_page(void *arg, int64 pagepos, char *page,
+							  char *errbuf, size_t errlen);
+static bool check_long_header(archive_reader *r);
+
+
+/*
+ * Open the archived segment log/seg of our timeline, compressed or not.
+ */
+static bool
+open_segment(archive_reader *r, uint32 log, uint32 seg)
+{
+	char		fname[MAXFNAMELEN];
+	char		path[MAXPGPATH];
+	bool		compressed = true;
+
+	close_segment(r);
+
+	XLogFileName(fname, r->tli, log, seg);
+
+#ifdef HAVE_LIBZ
+	snprintf(path, sizeof(path), "%s/%s.gz", r->archive_dir, fname);
+	r->gz = gzopen(path, "rb");
+	if (r->gz == NULL)
+	{
+		compressed = false;
+		snprintf(path, sizeof(path), "%s/%s", r->archive_dir, fname);
+		r->gz = gzopen(path, "rb");
+	}
+	if (r->gz == NULL)
+#else
+	compressed = false;
+	snprintf(path, sizeof(path), "%s/%s", r->archive_dir, fname);
+	r->fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (r->fd < 0)
+#endif
+	{
+		snprintf(r->errbuf, r->errlen,
+				 "could not open archived segment \"%s/%s\": %s",
+				 r->archive_dir, fname, strerror(errno));
+		return false;
+	}
+
+	/* the first segment opened is the one holding the REDO location */
+	if (r->result->bytes_read == 0)
+		r->result->compressed = compressed;
+
+	r->open = true;
+	r->log = log;
+	r->seg = seg;
+	r->next = 0;
+
+	return true;
+}
+
+static void
+close_segment(archive_reader *r)
+{
+	if (!r->open)
+		return;
+#ifdef HAVE_LIBZ
+	gzclose(r->gz);
+#else
+	close(r->fd);
+#endif
+	r->open = false;
+}
+
+/*
+ * Read the next page of the open segment.
+ */
+static bool
+read_next_page(archive_reader *r)
+{
+	int			n;
+
+	if (r->next >= XLogSegSize)
+		n = 0;
+	else
+#ifdef HAVE_LIBZ
+		n = gzread(r->gz, r->page, XLOG_BLCKSZ);
+#else
+		n = read(r->fd, r->page, XLOG_BLCKSZ);
+#endif
+
+	if (n != XLOG_BLCKSZ)
+	{
+		char		fname[MAXFNAMELEN];
+
+		XLogFileName(fname, r->tli, r->log, r->seg);
+		if (n < 0)
+			snprintf(r->errbuf, r->errlen,
+					 "could not read archived segment \"%s\" at offset %u",
+					 fname, r->next);
+		else
+			snprintf(r->errbuf, r->errlen,
+					 "archived segment \"%s\" is truncated at offset %u",
+					 fname, r->next + n);
+		return false;
+	}
+
+	r->next += XLOG_BLCKSZ;
+	r->result->bytes_read += XLOG_BLCKSZ;
+
+	return true;
+}
+
+/*
+ * Read the WAL page at linear position pagepos into page, for the WAL
+ * reader, which checks its header.  Pages are read forward only: switching
+ * segments opens the new one and checks its long header, pages in between
+ * within a segment are read and dropped, and going back starts over from
+ * the segment's start.
+ */
+static bool
+read_archive_page(void *arg, int64 pagepos, char *page,
+				  char *errbuf, size_t errlen)
+{
+	archive_reader *r = (archive_reader *) arg;
+	uint32		log = (uint32) (pagepos / XLogFileSize);
+	uint32		seg = (uint32) ((pagepos % XLogFileSize) / XLogSegSize);
+	uint32		offset = (uint32) (pagepos % XLogSegSize);
+
+	r->page = page;
+	r->errbuf = errbuf;
+	r->errlen = errlen;
+
+	if (!r->open || r->log != log || r->seg != seg || offset < r->next)
+	{
+		if (!open_segment(r, log, seg) ||
+			!read_next_page(r) ||
+			!check_long_header(r))
+			return false;
+	}
+
+#ifndef HAVE_LIBZ
+	/* a plain file can simply be positioned */
+	if (offset > r->next)
+	{
+		if (lseek(r->fd, (off_t) offset, SEEK_SET) != (off_t) offset)
+		{
+			snprintf(r->errbuf, r->errlen,
+					 "could not seek in archived segment: %s",
+					 strerror(errno));
+			return false;
+		}
+		r->next = offset;
+	}
+#endif
+
+	while (r->next <= offset)
+	{
+		if (!read_next_page(r))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Check the long header on the first page of a segment against pg_control.
+ */
+static bool
+check_long_header(archive_reader *r)
+{
+	XLogLongPageHeader lhdr = (XLogLongPageHeader) r->page;
+	const char *problem = NULL;
+	char		fname[MAXFNAMELEN];
+
+	if (lhdr->std.xlp_magic != XLOG_PAGE_MAGIC)
+		problem = "bad magic number";
+	else if (!(lhdr->std.xlp_info & XLP_LONG_HEADER))
+		problem = "no long header";
+	else if (lhdr->xlp_sysid != r->cf->system_identifier)
+		problem = "database system identifier differs from pg_control";
+	else if (lhdr->xlp_seg_size != r->cf->xlog_seg_size)
+		problem = "segment size differs from pg_control";
+	else if (lhdr->xlp_xlog_blcksz != r->cf->xlog_blcksz)
+		problem = "WAL block size differs from pg_control";
+	else if (lhdr->std.xlp_tli > r->tli)
+		problem = "page belongs to a later timeline";
+	else if (lhdr->std.xlp_pageaddr.xlogid != r->log ||
+			 lhdr->std.xlp_pageaddr.xrecoff != r->seg * XLogSegSize)
+		problem = "segment holds a different part of WAL";
+
+	if (problem == NULL)
+		return true;
+
+	XLogFileName(fname, r->tli, r->log, r->seg);
+	snprintf(r->errbuf, r->errlen,
+			 "invalid archived segment \"%s\": %s", fname, problem);
+	return false;
+}
+
+/*
+ * Check that archive_dir holds, intact, the segment with the REDO location
+ * of cf's latest checkpoint and the checkpoint record itself.
+ *
+ * Fills in result, including the error message on failure, and returns
+ * result->ok.
+ */
+bool
+pgcd_check_archive(const char *archive_dir, const ControlFileData *cf,
+				   pgcdArchiveCheck *result)
+{
+	archive_reader r;
+	pgcdWalReader wr;
+	union
+	{
+		XLogRecord	hdr;
+		double		force_align;
+		char		data[CHECKPOINT_RECORD_LEN];
+	}			rec;
+	XLogRecord *record;
+	CheckPoint	copy;
+	int64		redo = PGCD_LSN_POS(cf->checkPointCopy.redo);
+	int64		pos = PGCD_LSN_POS(cf->checkPoint);
+	int64		next = pos;
+	uint32		log;
+	uint32		seg;
+	uint32		pageoff;
+
+	memset(result, 0, sizeof(pgcdArchiveCheck));
+	memset(&r, 0, sizeof(r));
+	r.archive_dir = archive_dir;
+	r.cf = cf;
+	r.tli = cf->checkPointCopy.ThisTimeLineID;
+	r.result = result;
+	pgcd_wal_reader_init(&wr, read_archive_page, &r,
+						 rec.data, sizeof(rec.data));
+
+	XLByteToSeg(cf->checkPointCopy.redo, log, seg);
+	XLogFileName(result->redo_segment, r.tli, log, seg);
+	result->redo_offset = cf->checkPointCopy.redo.xrecoff % XLogSegSize;
+	XLByteToSeg(cf->checkPoint, log, seg);
+	XLogFileName(result->checkpoint_segment, r.tli, log, seg);
+	result->checkpoint_offset = cf->checkPoint.xrecoff % XLogSegSize;
+
+	/* we can only read WAL laid out the way this build lays it out */
+	if (cf->xlog_seg_size != XLogSegSize || cf->xlog_blcksz != XLOG_BLCKSZ)
+	{
+		snprintf(result->error, sizeof(result->error),
+				 "WAL segment size %u or block size %u differs from this build",
+				 cf->xlog_seg_size, cf->xlog_blcksz);
+		return false;
+	}
+	if (redo > pos)
+	{
+		snprintf(result->error, sizeof(result->error),
+				 "REDO location %X/%X is after checkpoint location %X/%X",
+				 cf->checkPointCopy.redo.xlogid, cf->checkPointCopy.redo.xrecoff,
+				 cf->checkPoint.xlogid, cf->checkPoint.xrecoff);
+		return false;
+	}
+
+	if (!pgcd_wal_load_page(&wr, redo - redo % XLOG_BLCKSZ))
+		goto failed;
+
+	/* the record must start right at the checkpoint location */
+	pageoff = (uint32) (pos % XLOG_BLCKSZ);
+	if (!pgcd_wal_load_page(&wr, pos - pageoff))
+		goto failed;
+	if (pageoff < XLogPageHeaderSize(&wr.page.hdr) ||
+		XLOG_BLCKSZ - pageoff < SizeOfXLogRecord)
+	{
+		snprintf(result->error, sizeof(result->error),
+				 "invalid checkpoint location %X/%X",
+				 cf->checkPoint.xlogid, cf->checkPoint.xrecoff);
+		goto done;
+	}
+
+	record = pgcd_wal_read_record(&wr, &next);
+	if (record == NULL && wr.rec_needed <= wr.rec_size)
+		goto failed;
+	if (record == NULL ||
+		record->xl_rmid != RM_XLOG_ID ||
+		((record->xl_info & ~XLR_INFO_MASK) != XLOG_CHECKPOINT_SHUTDOWN &&
+		 (record->xl_info & ~XLR_INFO_MASK) != XLOG_CHECKPOINT_ONLINE) ||
+		record->xl_len != sizeof(CheckPoint) ||
+		record->xl_tot_len != CHECKPOINT_RECORD_LEN)
+	{
+		snprintf(result->error, sizeof(result->error),
+				 "no checkpoint record at %X/%X in archived segment \"%s\"",
+				 cf->checkPoint.xlogid, cf->checkPoint.xrecoff,
+				 result->checkpoint_segment);
+		goto done;
+	}
+
+	memcpy(&copy, XLogRecGetData(record), sizeof(CheckPoint));
+	if (memcmp(&copy, &cf->checkPointCopy, sizeof(CheckPoint)) != 0)
+	{
+		snprintf(result->error, sizeof(result->error),
+				 "checkpoint record at %X/%X differs from pg_control",
+				 cf->checkPoint.xlogid, cf->checkPoint.xrecoff);
+		goto done;
+	}
+
+	result->ok = true;
+	goto done;
+
+failed:
+	strlcpy(result->error, wr.error, sizeof(result->error));
+
+done:
+	close_segment(&r);
+	return result->ok;
+}
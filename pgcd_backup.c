@@ -0,0 +1,96 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_backup.c
+ *		Check a WAL archive against a cluster's latest checkpoint.
+ *
+ * The check itself lives in pgcd_archive.c and is also available as
+ * "pg_controldata_tool archive", which checks many backups in parallel.
+ * Here it is run for one data directory, this cluster's by default.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/htup.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+
+#include "pg_controldata.h"
+
+
+Datum		pg_controldata_archive_check(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_archive_check);
+
+
+/*
+ * Check that archive_dir holds the REDO segment and the checkpoint record
+ * of the latest checkpoint in datadir's control file.
+ */
+Datum
+pg_controldata_archive_check(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[8];
+	bool		nulls[8];
+	char	   *archive_dir;
+	const char *datadir = DataDir;
+	ControlFileData cf;
+	pgcdArchiveCheck check;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to read the WAL archive")));
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+	archive_dir = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	if (!PG_ARGISNULL(1))
+		datadir = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	pgcd_read_controlfile(datadir, &cf, ERROR);
+	pgcd_check_archive(archive_dir, &cf, &check);
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = BoolGetDatum(check.ok);
+	values[1] = CStringGetTextDatum(check.redo_segment);
+	values[2] = Int64GetDatum((int64) check.redo_offset);
+	values[3] = CStringGetTextDatum(check.checkpoint_segment);
+	values[4] = Int64GetDatum((int64) check.checkpoint_offset);
+	values[5] = BoolGetDatum(check.compressed);
+	values[6] = Int64GetDatum(check.bytes_read);
+	if (check.ok)
+		nulls[7] = true;
+	else
+		values[7] = CStringGetTextDatum(check.error);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
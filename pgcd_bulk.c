@@ -0,0 +1,297 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_bulk.c
+ *		Bulk decoding of stored control file images into columnar batches.
+ *
+ * pg_controldata_image() returns the raw pg_control image so that it can
+ * be stored anywhere as bytea.  pg_controldata_decode() takes an array of
+ * such images and returns them in fixed-size batches, one array per field,
+ * which is what aggregates over large inventories want to consume.
+ *
+ * Decoding is done in two passes per batch.  The first validates every
+ * image (length, CRC, byte order) and copies the good ones into an aligned
+ * scratch array; the second walks that array once per output column with
+ * a tight loop that only extracts one field, so the per-image work is free
+ * of type dispatch and the output arrays are written sequentially.
+ *
+ * Images written by a machine of the other byte order are recognized by
+ * their byte-swapped pg_control_version and converted as their fields are
+ * extracted.  The CRC is the server's table-driven CRC-32 computed over the
+ * raw bytes, so it needs no conversion, only its stored value does.  Note
+ * that this is not CRC-32C, so there are no hardware instructions to speed
+ * it up.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include "pg_controldata.h"
+
+
+#define BSWAP32(x) \
+	((((x) & 0xff000000) >> 24) | (((x) & 0x00ff0000) >> 8) | \
+	 (((x) & 0x0000ff00) << 8) | (((x) & 0x000000ff) << 24))
+
+#define BSWAP64(x) \
+	(((uint64) BSWAP32((uint32) (x)) << 32) | \
+	 (uint64) BSWAP32((uint32) ((uint64) (x) >> 32)))
+
+/* fetch a field of image i, converting byte order if needed */
+#define GET32(i, field) \
+	(swapped[i] ? BSWAP32((uint32) imgs[i].field) : (uint32) imgs[i].field)
+#define GET64(i, field) \
+	(swapped[i] ? BSWAP64((uint64) imgs[i].field) : (uint64) imgs[i].field)
+#define GETPOS(i, ptr) \
+	((int64) GET32(i, ptr.xlogid) * (int64) XLogFileSize + \
+	 (int64) GET32(i, ptr.xrecoff))
+
+#define DECODE_COLS		14
+
+Datum		pg_controldata_image(PG_FUNCTION_ARGS);
+Datum		pg_controldata_decode(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_image);
+PG_FUNCTION_INFO_V1(pg_controldata_decode);
+
+static void decode_batch(Datum *images, bool *imgnulls, int n,
+			 ControlFileData *imgs, bool *swapped, bool *valid,
+			 Datum *values);
+
+
+/*
+ * Return the raw current control file image.
+ */
+Datum
+pg_controldata_image(PG_FUNCTION_ARGS)
+{
+	bytea	   *result;
+
+	result = (bytea *) palloc(VARHDRSZ + sizeof(ControlFileData));
+	SET_VARSIZE(result, VARHDRSZ + sizeof(ControlFileData));
+	pgcd_read_controlfile(DataDir, (ControlFileData *) VARDATA(result), ERROR);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+/*
+ * Decode n images into one output row of column arrays.
+ *
+ * imgs, swapped and valid are caller-supplied scratch space for n entries.
+ */
+static void
+decode_batch(Datum *images, bool *imgnulls, int n,
+			 ControlFileData *imgs, bool *swapped, bool *valid,
+			 Datum *values)
+{
+	Datum	   *col;
+	int			i;
+	int			c = 0;
+
+	/* Pass 1: validate and align. */
+	for (i = 0; i < n; i++)
+	{
+		bytea	   *img;
+		pg_crc32	crc;
+
+		valid[i] = false;
+		swapped[i] = false;
+		memset(&imgs[i], 0, sizeof(ControlFileData));
+
+		if (imgnulls[i])
+			continue;
+		img = DatumGetByteaP(images[i]);
+		if (VARSIZE(img) - VARHDRSZ < sizeof(ControlFileData))
+			continue;
+		memcpy(&imgs[i], VARDATA(img), sizeof(ControlFileData));
+
+		if (imgs[i].pg_control_version != PG_CONTROL_VERSION)
+			swapped[i] = true;
+
+		if (!swapped[i] ||
+			BSWAP32(imgs[i].pg_control_version) == PG_CONTROL_VERSION)
+		{
+			INIT_CRC32(crc);
+			COMP_CRC32(crc, (char *) &imgs[i], offsetof(ControlFileData, crc));
+			FIN_CRC32(crc);
+			valid[i] = EQ_CRC32(crc, GET32(i, crc));
+		}
+
+		if (!valid[i])
+		{
+			memset(&imgs[i], 0, sizeof(ControlFileData));
+			swapped[i] = false;
+		}
+	}
+
+	col = (Datum *) palloc(n * sizeof(Datum));
+
+	values[c++] = Int32GetDatum(n);
+
+	for (i = 0; i < n; i++)
+		col[i] = BoolGetDatum(valid[i]);
+	values[c++] = PointerGetDatum(construct_array(col, n, BOOLOID,
+												  1, true, 'c'));
+
+	/*
+	 * Pass 2: one loop per column.  Invalid images were zeroed above, so
+	 * they come out as zeroes without any special casing here.
+	 */
+#define INT8_COLUMN(expr) \
+	do { \
+		for (i = 0; i < n; i++) \
+			col[i] = Int64GetDatum((int64) (expr)); \
+		values[c++] = PointerGetDatum(construct_array(col, n, INT8OID, \
+								sizeof(int64), FLOAT8PASSBYVAL, 'd')); \
+	} while (0)
+#define INT4_COLUMN(expr) \
+	do { \
+		for (i = 0; i < n; i++) \
+			col[i] = Int32GetDatum((int32) (expr)); \
+		values[c++] = PointerGetDatum(construct_array(col, n, INT4OID, \
+								sizeof(int32), true, 'i')); \
+	} while (0)
+#define TIME_COLUMN(expr) \
+	do { \
+		for (i = 0; i < n; i++) \
+			col[i] = TimestampTzGetDatum(time_t_to_timestamptz((pg_time_t) (expr))); \
+		values[c++] = PointerGetDatum(construct_array(col, n, TIMESTAMPTZOID, \
+								sizeof(TimestampTz), FLOAT8PASSBYVAL, 'd')); \
+	} while (0)
+
+	INT8_COLUMN(GET64(i, system_identifier));
+	INT4_COLUMN(GET32(i, state));
+	TIME_COLUMN(GET64(i, time));
+	INT8_COLUMN(GETPOS(i, checkPoint));
+	INT8_COLUMN(GETPOS(i, checkPointCopy.redo));
+	INT4_COLUMN(GET32(i, checkPointCopy.ThisTimeLineID));
+	INT8_COLUMN(PGCD_FULL_XID(GET32(i, checkPointCopy.nextXidEpoch),
+							  GET32(i, checkPointCopy.nextXid)));
+	INT8_COLUMN(GET32(i, checkPointCopy.nextOid));
+	INT8_COLUMN(GET32(i, checkPointCopy.nextMulti));
+	INT8_COLUMN(GET32(i, checkPointCopy.nextMultiOffset));
+	INT8_COLUMN(GET32(i, checkPointCopy.oldestXid));
+	TIME_COLUMN(GET64(i, checkPointCopy.time));
+
+#undef INT8_COLUMN
+#undef INT4_COLUMN
+#undef TIME_COLUMN
+
+	Assert(c == DECODE_COLS);
+	pfree(col);
+}
+
+/*
+ * Decode an array of control file images into batches of column arrays.
+ */
+Datum
+pg_controldata_decode(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	ArrayType		   *arr = PG_GETARG_ARRAYTYPE_P(0);
+	int					batch_size = PG_GETARG_INT32(1);
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	MemoryContext		batch_ctx;
+	Datum			   *images;
+	bool			   *imgnulls;
+	int					nimages;
+	ControlFileData	   *imgs;
+	bool			   *swapped;
+	bool			   *valid;
+	int					start;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	if (batch_size < 1 || batch_size > MaxAllocSize / sizeof(ControlFileData))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("batch size %d is out of range", batch_size)));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	deconstruct_array(arr, BYTEAOID, -1, false, 'i',
+					  &images, &imgnulls, &nimages);
+
+	imgs = (ControlFileData *) palloc(batch_size * sizeof(ControlFileData));
+	swapped = (bool *) palloc(batch_size * sizeof(bool));
+	valid = (bool *) palloc(batch_size * sizeof(bool));
+
+	/* detoasted images and column arrays only live for one batch */
+	batch_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  "pg_controldata_decode batch",
+									  ALLOCSET_DEFAULT_MINSIZE,
+									  ALLOCSET_DEFAULT_INITSIZE,
+									  ALLOCSET_DEFAULT_MAXSIZE);
+
+	for (start = 0; start < nimages; start += batch_size)
+	{
+		int			n = Min(batch_size, nimages - start);
+		Datum		values[DECODE_COLS + 1];
+		bool		nulls[DECODE_COLS + 1];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		oldcontext = MemoryContextSwitchTo(batch_ctx);
+
+		values[0] = Int32GetDatum(start / batch_size + 1);
+		decode_batch(images + start, imgnulls + start, n,
+					 imgs, swapped, valid, values + 1);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(batch_ctx);
+	}
+
+	MemoryContextDelete(batch_ctx);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
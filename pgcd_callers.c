@@ -0,0 +1,409 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_callers.c
+ *		Per-role and per-application accounting of pg_controldata() calls.
+ *
+ * Counters are kept in a shared hash table keyed by role and
+ * application_name, managed the same way pg_stat_statements does it: the
+ * table lock is taken in shared mode to find an entry and only in
+ * exclusive mode to create one, while counters are updated under a
+ * per-entry spinlock.  Once the table is full, new callers are lumped into
+ * a single overflow entry with no role and application "<other>".
+ *
+ * The same entries carry the time of each caller's last real read of
+ * pg_control, which is what pg_controldata.min_refresh_interval is
+ * enforced against.  Since that setting can be attached to roles and
+ * databases with ALTER ... SET, and the window is tracked per role and
+ * application, a misbehaving agent only ever throttles itself as long as
+ * it has an entry of its own.  Callers in the overflow entry share its one
+ * window, which keeps the reads on their behalf bounded even when a client
+ * fills the table by cycling through application names.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+
+#include "pg_controldata.h"
+
+
+#define OVERFLOW_APPNAME	"<other>"
+
+/*
+ * Hashtable key; zero-padded so that it can be hashed as a blob.
+ */
+typedef struct pgcdCallerKey
+{
+	Oid			userid;
+	char		appname[NAMEDATALEN];
+} pgcdCallerKey;
+
+typedef struct pgcdCallerEntry
+{
+	pgcdCallerKey key;			/* hash key of entry - MUST BE FIRST */
+	slock_t		mutex;			/* protects the counters only */
+	int64		calls;
+	double		total_time;		/* in msec */
+	double		max_time;		/* in msec */
+	int64		outcomes[PGCD_NUM_OUTCOMES];
+	TimestampTz	last_read;		/* last call that read pg_control */
+} pgcdCallerEntry;
+
+typedef struct pgcdCallerState
+{
+	LWLockId	lock;			/* protects hashtable search/modification */
+	TimestampTz	reset_time;
+} pgcdCallerState;
+
+/* GUC variables */
+int			pgcd_max_callers;
+int			pgcd_min_refresh_interval;
+
+static pgcdCallerState *callers = NULL;
+static HTAB *caller_hash = NULL;
+
+static pgcdCallerEntry *caller_entry(const pgcdCallerKey *key);
+static pgcdCallerEntry *current_caller(void);
+
+Datum		pg_controldata_callers(PG_FUNCTION_ARGS);
+Datum		pg_controldata_callers_reset(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_callers);
+PG_FUNCTION_INFO_V1(pg_controldata_callers_reset);
+
+
+void
+pgcd_callers_init(void)
+{
+	DefineCustomIntVariable("pg_controldata.max_callers",
+							"Sets the maximum number of callers tracked.",
+							NULL,
+							&pgcd_max_callers,
+							256,
+							16,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_controldata.min_refresh_interval",
+		"Sets the minimum time between two reads of pg_control on behalf of "
+							"the same role and application.",
+		"Calls arriving sooner get the shared copy of the latest image.  "
+							"Zero disables rate limiting.",
+							&pgcd_min_refresh_interval,
+							0,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL);
+}
+
+Size
+pgcd_callers_shmem_size(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(pgcdCallerState));
+	size = add_size(size, hash_estimate_size(pgcd_max_callers,
+											 sizeof(pgcdCallerEntry)));
+
+	return size;
+}
+
+void
+pgcd_callers_shmem_startup(void)
+{
+	bool		found;
+	HASHCTL		info;
+
+	callers = ShmemInitStruct("pg_controldata callers",
+							  sizeof(pgcdCallerState),
+							  &found);
+
+	if (!found)
+	{
+		callers->lock = LWLockAssign();
+		callers->reset_time = GetCurrentTimestamp();
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(pgcdCallerKey);
+	info.entrysize = sizeof(pgcdCallerEntry);
+	info.hash = tag_hash;
+	caller_hash = ShmemInitHash("pg_controldata caller hash",
+								pgcd_max_callers, pgcd_max_callers,
+								&info,
+								HASH_ELEM | HASH_FUNCTION);
+}
+
+/*
+ * Find or create the entry for key.  Caller must hold the lock in
+ * exclusive mode if the entry might not exist yet.
+ */
+static pgcdCallerEntry *
+caller_entry(const pgcdCallerKey *key)
+{
+	pgcdCallerEntry *entry;
+	pgcdCallerKey overflow;
+	bool		found;
+
+	entry = (pgcdCallerEntry *) hash_search(caller_hash, key,
+											HASH_FIND, NULL);
+	if (entry)
+		return entry;
+
+	/* keep one slot free for the overflow entry */
+	if (hash_get_num_entries(caller_hash) >= pgcd_max_callers - 1)
+	{
+		memset(&overflow, 0, sizeof(overflow));
+		overflow.userid = InvalidOid;
+		strlcpy(overflow.appname, OVERFLOW_APPNAME, NAMEDATALEN);
+		key = &overflow;
+	}
+
+	entry = (pgcdCallerEntry *) hash_search(caller_hash, key,
+											HASH_ENTER, &found);
+	if (!found)
+	{
+		SpinLockInit(&entry->mutex);
+		entry->calls = 0;
+		entry->total_time = 0;
+		entry->max_time = 0;
+		memset(entry->outcomes, 0, sizeof(entry->outcomes));
+		entry->last_read = 0;
+	}
+
+	return entry;
+}
+
+/*
+ * Find or create the entry for the current role and application.  Returns
+ * with the lock held, in shared or exclusive mode.
+ */
+static pgcdCallerEntry *
+current_caller(void)
+{
+	pgcdCallerKey key;
+	pgcdCallerEntry *entry;
+
+	memset(&key, 0, sizeof(key));
+	key.userid = GetUserId();
+	if (application_name)
+		strlcpy(key.appname, application_name, NAMEDATALEN);
+
+	LWLockAcquire(callers->lock, LW_SHARED);
+
+	entry = (pgcdCallerEntry *) hash_search(caller_hash, &key,
+											HASH_FIND, NULL);
+	if (!entry)
+	{
+		/* Must acquire exclusive lock to add a new entry. */
+		LWLockRelease(callers->lock);
+		LWLockAcquire(callers->lock, LW_EXCLUSIVE);
+		entry = caller_entry(&key);
+	}
+
+	return entry;
+}
+
+/*
+ * Should the current caller be served the shared copy instead of reading
+ * pg_control?  If not, the read is charged to its window.
+ */
+bool
+pgcd_callers_throttled(TimestampTz now)
+{
+	volatile pgcdCallerEntry *e;
+	bool		throttled;
+
+	if (!callers || pgcd_min_refresh_interval <= 0)
+		return false;
+
+	e = (volatile pgcdCallerEntry *) current_caller();
+
+	SpinLockAcquire(&e->mutex);
+	throttled = !TimestampDifferenceExceeds(e->last_read, now,
+											pgcd_min_refresh_interval);
+	if (!throttled)
+		e->last_read = now;
+	SpinLockRelease(&e->mutex);
+
+	LWLockRelease(callers->lock);
+
+	return throttled;
+}
+
+/*
+ * Charge one call taking msec milliseconds to the current role and
+ * application.
+ */
+void
+pgcd_callers_count(pgcdCallOutcome outcome, double msec)
+{
+	pgcdCallerEntry *entry;
+
+	if (!callers)
+		return;
+
+	entry = current_caller();
+
+	/*
+	 * Grab the spinlock while updating the counters (see comment about
+	 * locking rules at the head of the file)
+	 */
+	{
+		volatile pgcdCallerEntry *e = (volatile pgcdCallerEntry *) entry;
+
+		SpinLockAcquire(&e->mutex);
+		e->calls += 1;
+		e->total_time += msec;
+		if (msec > e->max_time)
+			e->max_time = msec;
+		e->outcomes[outcome] += 1;
+		SpinLockRelease(&e->mutex);
+	}
+
+	LWLockRelease(callers->lock);
+}
+
+/*
+ * Report the per-caller counters.
+ */
+Datum
+pg_controldata_callers(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	HASH_SEQ_STATUS		hash_seq;
+	pgcdCallerEntry	   *entry;
+
+	if (!callers)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(callers->lock, LW_SHARED);
+
+	hash_seq_init(&hash_seq, caller_hash);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		Datum		values[6 + PGCD_NUM_OUTCOMES];
+		bool		nulls[6 + PGCD_NUM_OUTCOMES];
+		int			i = 0;
+		int			j;
+		pgcdCallerEntry tmp;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		/* copy counters to a local variable to keep locking time short */
+		{
+			volatile pgcdCallerEntry *e = (volatile pgcdCallerEntry *) entry;
+
+			SpinLockAcquire(&e->mutex);
+			tmp = *e;
+			SpinLockRelease(&e->mutex);
+		}
+
+		if (OidIsValid(tmp.key.userid))
+			values[i++] = ObjectIdGetDatum(tmp.key.userid);
+		else
+			nulls[i++] = true;
+		values[i++] = CStringGetTextDatum(tmp.key.appname);
+		values[i++] = Int64GetDatumFast(tmp.calls);
+		values[i++] = Float8GetDatumFast(tmp.total_time);
+		values[i++] = Float8GetDatumFast(tmp.max_time);
+		for (j = 0; j < PGCD_NUM_OUTCOMES; j++)
+			values[i++] = Int64GetDatumFast(tmp.outcomes[j]);
+		values[i++] = TimestampTzGetDatum(callers->reset_time);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	LWLockRelease(callers->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Reset all per-caller counters.
+ */
+Datum
+pg_controldata_callers_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS hash_seq;
+	pgcdCallerEntry *entry;
+
+	if (!callers)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	LWLockAcquire(callers->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&hash_seq, caller_hash);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		hash_search(caller_hash, &entry->key, HASH_REMOVE, NULL);
+
+	callers->reset_time = GetCurrentTimestamp();
+
+	LWLockRelease(callers->lock);
+
+	PG_RETURN_VOID();
+}
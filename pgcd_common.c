@@ -0,0 +1,642 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_common.c
+ *		Control file and WAL handling shared by the server module and the
+ *		client programs.
+ *
+ * This file is compiled both into the server module and, with FRONTEND
+ * defined, into the programs under tools/.  Nothing here may ereport or
+ * palloc; errors are returned in caller-supplied buffers.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#ifdef FRONTEND
+#include "postgres_fe.h"
+#else
+#include "postgres.h"
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "access/rmgr.h"
+
+#include "pgcd_common.h"
+
+
+/* sanity limit on the length of one WAL record */
+#define MAX_RECORD_LEN		(1024 * 1024 * 1024)
+
+static bool control_crc_ok(const ControlFileData *cf);
+static int	candidate_cmp(const void *a, const void *b);
+
+
+const char *const pgcd_setting_names[PGCD_NUM_SETTINGS] =
+{
+	"pg_control version number",
+	"Catalog version number",
+	"Database system identifier",
+	"Database cluster state",
+	"pg_control last modified",
+	"Latest checkpoint location",
+	"Prior checkpoint location",
+	"Latest checkpoint's REDO location",
+	"Latest checkpoint's TimeLineID",
+	"Latest checkpoint's NextXID",
+	"Latest checkpoint's NextOID",
+	"Latest checkpoint's NextMultiXactId",
+	"Latest checkpoint's NextMultiOffset",
+	"Latest checkpoint's oldestXID",
+	"Latest checkpoint's oldestXID's DB",
+	"Latest checkpoint's oldestActiveXID",
+	"Time of latest checkpoint",
+	"Minimum recovery ending location",
+	"Backup start location",
+	"Maximum data alignment",
+	"Database block size",
+	"Blocks per segment of large relation",
+	"WAL block size",
+	"Bytes per WAL segment",
+	"Maximum length of identifiers",
+	"Maximum columns in an index",
+	"Maximum size of a TOAST chunk",
+	"Date/time type storage",
+	"Float4 argument passing",
+	"Float8 argument passing"
+};
+
+
+const char *
+pgcd_dbstate(DBState state)
+{
+	switch (state)
+	{
+		case DB_STARTUP:
+			return _("starting up");
+		case DB_SHUTDOWNED:
+			return _("shut down");
+		case DB_SHUTDOWNING:
+			return _("shutting down");
+		case DB_IN_CRASH_RECOVERY:
+			return _("in crash recovery");
+		case DB_IN_ARCHIVE_RECOVERY:
+			return _("in archive recovery");
+		case DB_IN_PRODUCTION:
+			return _("in production");
+	}
+	return _("unrecognized status code");
+}
+
+/*
+ * Format every setting the way pg_controldata prints it, in the order of
+ * pgcd_setting_names.
+ *
+ * This slightly-chintzy coding will work as long as the control file
+ * timestamps are within the range of time_t; that should be the case in
+ * all foreseeable circumstances, so we don't bother importing the
+ * backend's timezone library.  localtime() makes this unsafe to call from
+ * several threads at once.
+ */
+void
+pgcd_format_settings(const ControlFileData *cf,
+					 char settings[][PGCD_SETTING_LEN])
+{
+	const CheckPoint *ckpt = &cf->checkPointCopy;
+	time_t		time_tmp;
+	int			i = 0;
+
+	/*
+	 * Use variable for format to suppress overly-anal-retentive gcc warning
+	 * about %c
+	 */
+	const char *strftime_fmt = "%c";
+
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->pg_control_version);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->catalog_version_no);
+	snprintf(settings[i++], PGCD_SETTING_LEN, UINT64_FORMAT,
+			 cf->system_identifier);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%s", pgcd_dbstate(cf->state));
+	time_tmp = (time_t) cf->time;
+	strftime(settings[i++], PGCD_SETTING_LEN, strftime_fmt,
+			 localtime(&time_tmp));
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%X/%X",
+			 cf->checkPoint.xlogid, cf->checkPoint.xrecoff);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%X/%X",
+			 cf->prevCheckPoint.xlogid, cf->prevCheckPoint.xrecoff);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%X/%X",
+			 ckpt->redo.xlogid, ckpt->redo.xrecoff);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", ckpt->ThisTimeLineID);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u/%u",
+			 ckpt->nextXidEpoch, ckpt->nextXid);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", ckpt->nextOid);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", ckpt->nextMulti);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", ckpt->nextMultiOffset);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", ckpt->oldestXid);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", ckpt->oldestXidDB);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", ckpt->oldestActiveXid);
+	time_tmp = (time_t) ckpt->time;
+	strftime(settings[i++], PGCD_SETTING_LEN, strftime_fmt,
+			 localtime(&time_tmp));
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%X/%X",
+			 cf->minRecoveryPoint.xlogid, cf->minRecoveryPoint.xrecoff);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%X/%X",
+			 cf->backupStartPoint.xlogid, cf->backupStartPoint.xrecoff);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->maxAlign);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->blcksz);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->relseg_size);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->xlog_blcksz);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->xlog_seg_size);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->nameDataLen);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->indexMaxKeys);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%u", cf->toast_max_chunk_size);
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%s",
+			 cf->enableIntTimes ? "64-bit integers" : "floating-point numbers");
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%s",
+			 cf->float4ByVal ? "by value" : "by reference");
+	snprintf(settings[i++], PGCD_SETTING_LEN, "%s",
+			 cf->float8ByVal ? "by value" : "by reference");
+}
+
+#ifdef FRONTEND
+
+/*
+ * The server's CRC table lives in the backend, so client programs build
+ * their own copy of the same reflected CRC-32 on first use.
+ */
+static uint32 crc_table[256];
+static bool crc_table_ready = false;
+
+/*
+ * Build the CRC table.  Programs that read control files on several
+ * threads must call this before starting them.
+ */
+void
+pgcd_init(void)
+{
+	uint32		i;
+	int			k;
+
+	if (crc_table_ready)
+		return;
+
+	for (i = 0; i < 256; i++)
+	{
+		uint32		c = i;
+
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+		crc_table[i] = c;
+	}
+	crc_table_ready = true;
+}
+
+/*
+ * Add len bytes at data to a running CRC, which starts out as
+ * PGCD_CRC_INIT and is finished by XOR with PGCD_CRC_INIT, like the
+ * server's INIT_CRC32/COMP_CRC32/FIN_CRC32.
+ */
+uint32
+pgcd_crc32_update(uint32 crc, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+
+	pgcd_init();
+
+	while (len-- > 0)
+		crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return crc;
+}
+
+static bool
+control_crc_ok(const ControlFileData *cf)
+{
+	uint32		crc;
+
+	crc = pgcd_crc32_update(PGCD_CRC_INIT, cf,
+							offsetof(ControlFileData, crc));
+
+	return (crc ^ PGCD_CRC_INIT) == cf->crc;
+}
+
+#else
+
+/*
+ * Same as the FRONTEND version, on the server's CRC table.
+ */
+uint32
+pgcd_crc32_update(uint32 crc, const void *data, size_t len)
+{
+	pg_crc32	c = crc;
+
+	COMP_CRC32(c, data, len);
+
+	return c;
+}
+
+static bool
+control_crc_ok(const ControlFileData *cf)
+{
+	pg_crc32	crc;
+
+	INIT_CRC32(crc);
+	COMP_CRC32(crc,
+			   (char *) cf,
+			   offsetof(ControlFileData, crc));
+	FIN_CRC32(crc);
+
+	return EQ_CRC32(crc, cf->crc);
+}
+
+#endif   /* FRONTEND */
+
+/*
+ * Read and verify the control file of the cluster at datadir.
+ *
+ * On failure, returns false with a message in errbuf.
+ */
+bool
+pgcd_load_controlfile(const char *datadir, ControlFileData *cf,
+					  char *errbuf, size_t errlen)
+{
+	int				fd;
+	char			ControlFilePath[MAXPGPATH];
+
+	snprintf(ControlFilePath, MAXPGPATH, "%s/global/pg_control", datadir);
+
+	if ((fd = open(ControlFilePath, O_RDONLY | PG_BINARY, 0)) == -1)
+	{
+		snprintf(errbuf, errlen, "could not open file \"%s\" for reading: %s",
+				 ControlFilePath, strerror(errno));
+		return false;
+	}
+
+	if (read(fd, cf, sizeof(ControlFileData)) != sizeof(ControlFileData))
+	{
+		snprintf(errbuf, errlen, "could not read file \"%s\": %s",
+				 ControlFilePath, strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	if (!control_crc_ok(cf))
+	{
+		snprintf(errbuf, errlen,
+				 "calculated CRC checksum does not match value stored in file \"%s\"",
+				 ControlFilePath);
+		return false;
+	}
+
+	if (cf->pg_control_version != PG_CONTROL_VERSION)
+	{
+		snprintf(errbuf, errlen, "file \"%s\" has version %u, expected %u",
+				 ControlFilePath, cf->pg_control_version, PG_CONTROL_VERSION);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Verify a control file image held in memory, e.g. one read by some other
+ * program, and copy it into cf.
+ */
+bool
+pgcd_decode_controlfile(const char *image, size_t len, ControlFileData *cf,
+						char *errbuf, size_t errlen)
+{
+	if (len < sizeof(ControlFileData))
+	{
+		snprintf(errbuf, errlen, "control file image is too short (%lu bytes)",
+				 (unsigned long) len);
+		return false;
+	}
+
+	memcpy(cf, image, sizeof(ControlFileData));
+
+	if (!control_crc_ok(cf))
+	{
+		snprintf(errbuf, errlen,
+				 "calculated CRC checksum does not match value stored in image");
+		return false;
+	}
+
+	if (cf->pg_control_version != PG_CONTROL_VERSION)
+	{
+		snprintf(errbuf, errlen,
+				 "control file image has version %u, expected %u",
+				 cf->pg_control_version, PG_CONTROL_VERSION);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Read one standby's control file into cand.
+ *
+ * On a standby, checkPoint is the latest restartpoint and minRecoveryPoint
+ * is how far WAL has been replayed and flushed to disk.  A cleanly shut
+ * down standby may have a minRecoveryPoint behind its last restartpoint,
+ * so we take whichever is further along.
+ */
+void
+pgcd_candidate_load(pgcdCandidate *cand, const char *datadir)
+{
+	memset(cand, 0, sizeof(pgcdCandidate));
+	cand->datadir = datadir;
+
+	cand->ok = pgcd_load_controlfile(datadir, &cand->control,
+									 cand->error, sizeof(cand->error));
+	if (!cand->ok)
+		return;
+
+	cand->timeline = cand->control.checkPointCopy.ThisTimeLineID;
+	cand->restartpoint_pos = PGCD_LSN_POS(cand->control.checkPoint);
+	cand->replay_pos = Max(PGCD_LSN_POS(cand->control.minRecoveryPoint),
+						   cand->restartpoint_pos);
+}
+
+/* best first: highest timeline, then most replayed, then newest restartpoint */
+static int
+candidate_cmp(const void *a, const void *b)
+{
+	const pgcdCandidate *ca = (const pgcdCandidate *) a;
+	const pgcdCandidate *cb = (const pgcdCandidate *) b;
+
+	if (ca->ok != cb->ok)
+		return ca->ok ? -1 : 1;
+	if (ca->timeline != cb->timeline)
+		return (ca->timeline > cb->timeline) ? -1 : 1;
+	if (ca->replay_pos != cb->replay_pos)
+		return (ca->replay_pos > cb->replay_pos) ? -1 : 1;
+	if (ca->restartpoint_pos != cb->restartpoint_pos)
+		return (ca->restartpoint_pos > cb->restartpoint_pos) ? -1 : 1;
+	return strcmp(ca->datadir, cb->datadir);
+}
+
+/*
+ * Sort loaded candidates best first and fill in rank and gap.  Candidates
+ * whose control file could not be read sort last with rank 0.
+ */
+void
+pgcd_rank_candidates(pgcdCandidate *cands, int n)
+{
+	int			i;
+
+	qsort(cands, n, sizeof(pgcdCandidate), candidate_cmp);
+
+	for (i = 0; i < n; i++)
+	{
+		if (!cands[i].ok)
+			continue;
+		cands[i].rank = i + 1;
+		cands[i].gap = cands[0].replay_pos - cands[i].replay_pos;
+	}
+}
+
+/*
+ * Set up r to read records through read_page into the size bytes at buf.
+ */
+void
+pgcd_wal_reader_init(pgcdWalReader *r, pgcdReadPageFn read_page, void *arg,
+					 char *buf, uint32 size)
+{
+	memset(r, 0, sizeof(pgcdWalReader));
+	r->read_page = read_page;
+	r->arg = arg;
+	r->rec = buf;
+	r->rec_size = size;
+	r->rec_pos = -1;
+	r->prev_pos = -1;
+	r->page_pos = -1;
+}
+
+/*
+ * Make r->page hold the WAL page at linear position pagepos and check that
+ * it is a valid page of that position.
+ */
+bool
+pgcd_wal_load_page(pgcdWalReader *r, int64 pagepos)
+{
+	XLogPageHeader hdr = &r->page.hdr;
+	uint32		log = (uint32) (pagepos / XLogFileSize);
+	uint32		off = (uint32) (pagepos % XLogFileSize);
+
+	if (r->page_pos == pagepos)
+		return true;
+	r->page_pos = -1;
+
+	r->error[0] = '\0';
+	if (!r->read_page(r->arg, pagepos, r->page.data,
+					  r->error, sizeof(r->error)))
+	{
+		if (r->error[0] == '\0')
+			snprintf(r->error, sizeof(r->error),
+					 "could not read WAL page at %X/%X", log, off);
+		return false;
+	}
+
+	if (hdr->xlp_magic != XLOG_PAGE_MAGIC ||
+		hdr->xlp_pageaddr.xlogid != log ||
+		hdr->xlp_pageaddr.xrecoff != off)
+	{
+		snprintf(r->error, sizeof(r->error),
+				 "invalid WAL page header at %X/%X: magic %04X, address %X/%X",
+				 log, off, hdr->xlp_magic,
+				 hdr->xlp_pageaddr.xlogid, hdr->xlp_pageaddr.xrecoff);
+		return false;
+	}
+
+	r->page_pos = pagepos;
+	return true;
+}
+
+/*
+ * Check the CRC of a reassembled record, backup blocks included.
+ */
+bool
+pgcd_wal_record_crc_ok(const XLogRecord *rec)
+{
+	const char *blk = XLogRecGetData(rec) + rec->xl_len;
+	const char *end = (const char *) rec + rec->xl_tot_len;
+	uint32		crc;
+	int			i;
+
+	if (rec->xl_len > rec->xl_tot_len - SizeOfXLogRecord)
+		return false;
+
+	crc = pgcd_crc32_update(PGCD_CRC_INIT, XLogRecGetData(rec), rec->xl_len);
+
+	for (i = 0; i < XLR_MAX_BKP_BLOCKS; i++)
+	{
+		BkpBlock	bkpb;
+		uint32		blen;
+
+		if (!(rec->xl_info & XLR_SET_BKP_BLOCK(i)))
+			continue;
+
+		if (end - blk < (long) sizeof(BkpBlock))
+			return false;
+		memcpy(&bkpb, blk, sizeof(BkpBlock));
+		if (bkpb.hole_offset + bkpb.hole_length > BLCKSZ)
+			return false;
+		blen = sizeof(BkpBlock) + BLCKSZ - bkpb.hole_length;
+		if (end - blk < (long) blen)
+			return false;
+
+		crc = pgcd_crc32_update(crc, blk, blen);
+		blk += blen;
+	}
+
+	if (blk != end)
+		return false;
+
+	crc = pgcd_crc32_update(crc, (const char *) rec + sizeof(pg_crc32),
+							SizeOfXLogRecord - sizeof(pg_crc32));
+
+	return (crc ^ PGCD_CRC_INIT) == rec->xl_crc;
+}
+
+/*
+ * Read the record at or after *pos into r->rec, skipping page headers, and
+ * advance *pos past it, or to the next segment after a switch record.
+ * Returns NULL, with a message in r->error, at the end of valid WAL or if
+ * the record is longer than r->rec_size; *pos is then left alone.
+ */
+XLogRecord *
+pgcd_wal_read_record(pgcdWalReader *r, int64 *pos)
+{
+	int64		p = *pos;
+	int64		start;
+	uint32		pageoff;
+	uint32		total;
+	uint32		got;
+	XLogRecord *hdr;
+
+	r->rec_needed = 0;
+
+	/* the record header is never split across pages */
+	for (;;)
+	{
+		pageoff = (uint32) (p % XLOG_BLCKSZ);
+		if (!pgcd_wal_load_page(r, p - pageoff))
+			return NULL;
+		if (pageoff == 0)
+			p += XLogPageHeaderSize(&r->page.hdr);
+		else if (XLOG_BLCKSZ - pageoff < SizeOfXLogRecord)
+			p += XLOG_BLCKSZ - pageoff;
+		else
+			break;
+	}
+
+	start = p;
+	hdr = (XLogRecord *) (r->page.data + pageoff);
+	total = hdr->xl_tot_len;
+	if (total < SizeOfXLogRecord || total > MAX_RECORD_LEN)
+	{
+		snprintf(r->error, sizeof(r->error),
+				 "invalid record length %u at %X/%X", total,
+				 (uint32) (start / XLogFileSize),
+				 (uint32) (start % XLogFileSize));
+		return NULL;
+	}
+	if (r->prev_pos >= 0 && PGCD_LSN_POS(hdr->xl_prev) != r->prev_pos)
+	{
+		snprintf(r->error, sizeof(r->error),
+				 "record at %X/%X does not follow the previous record",
+				 (uint32) (start / XLogFileSize),
+				 (uint32) (start % XLogFileSize));
+		return NULL;
+	}
+
+	r->rec_needed = total;
+	if (total > r->rec_size)
+	{
+		snprintf(r->error, sizeof(r->error),
+				 "record at %X/%X is longer than %u bytes",
+				 (uint32) (start / XLogFileSize),
+				 (uint32) (start % XLogFileSize), r->rec_size);
+		return NULL;
+	}
+
+	got = Min(total, XLOG_BLCKSZ - pageoff);
+	memcpy(r->rec, hdr, got);
+	p += got;
+
+	/* the rest continues on the next pages, possibly in the next segment */
+	while (got < total)
+	{
+		XLogContRecord *cont;
+		uint32		n;
+
+		if (!pgcd_wal_load_page(r, p))
+			return NULL;
+		if (!(r->page.hdr.xlp_info & XLP_FIRST_IS_CONTRECORD))
+		{
+			snprintf(r->error, sizeof(r->error),
+					 "record at %X/%X is not continued",
+					 (uint32) (start / XLogFileSize),
+					 (uint32) (start % XLogFileSize));
+			return NULL;
+		}
+		p += XLogPageHeaderSize(&r->page.hdr);
+		cont = (XLogContRecord *) (r->page.data + p % XLOG_BLCKSZ);
+		if (cont->xl_rem_len != total - got)
+		{
+			snprintf(r->error, sizeof(r->error),
+					 "invalid continuation of record at %X/%X",
+					 (uint32) (start / XLogFileSize),
+					 (uint32) (start % XLogFileSize));
+			return NULL;
+		}
+		p += SizeOfXLogContRecord;
+
+		n = Min(total - got, (uint32) (XLOG_BLCKSZ - p % XLOG_BLCKSZ));
+		memcpy(r->rec + got, r->page.data + p % XLOG_BLCKSZ, n);
+		got += n;
+		p += n;
+	}
+
+	if (!pgcd_wal_record_crc_ok((XLogRecord *) r->rec))
+	{
+		snprintf(r->error, sizeof(r->error),
+				 "incorrect checksum of record at %X/%X",
+				 (uint32) (start / XLogFileSize),
+				 (uint32) (start % XLogFileSize));
+		return NULL;
+	}
+
+	r->rec_pos = start;
+	r->prev_pos = start;
+	*pos = (p + MAXIMUM_ALIGNOF - 1) & ~((int64) MAXIMUM_ALIGNOF - 1);
+
+	/* the rest of the segment after a switch record is unused, see ReadRecord */
+	if (PGCD_IS_XLOG_SWITCH((XLogRecord *) r->rec) && *pos % XLogSegSize != 0)
+		*pos += XLogSegSize - *pos % XLogSegSize;
+
+	return (XLogRecord *) r->rec;
+}
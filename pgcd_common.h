@@ -0,0 +1,151 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_common.h
+ *		Control file and WAL handling shared by the server module and the
+ *		client programs.  Include after postgres.h or postgres_fe.h.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+#ifndef PGCD_COMMON_H
+#define PGCD_COMMON_H
+
+#include "access/xlog_internal.h"
+#include "catalog/pg_control.h"
+
+/*
+ * Linear byte position of a WAL location.  XLogRecPtr is a two-part value
+ * and the last segment of every logical xlog file is never used, so plain
+ * (xlogid << 32 | xrecoff) arithmetic would overstate distances.
+ */
+#define PGCD_LSN_POS(ptr) \
+	((int64) (ptr).xlogid * (int64) XLogFileSize + (int64) (ptr).xrecoff)
+
+/* 64-bit transaction counter including the epoch */
+#define PGCD_FULL_XID(epoch, xid) \
+	(((int64) (epoch) << 32) | (int64) (xid))
+
+/* whether a WAL record is a segment switch; needs access/rmgr.h */
+#define PGCD_IS_XLOG_SWITCH(rec) \
+	((rec)->xl_rmid == RM_XLOG_ID && \
+	 ((rec)->xl_info & ~XLR_INFO_MASK) == XLOG_SWITCH)
+
+#define PGCD_ERRBUF_SIZE	(MAXPGPATH + 128)
+
+/* start and final XOR of pgcd_crc32_update() */
+#define PGCD_CRC_INIT	0xFFFFFFFF
+
+/* the name/setting pairs printed by pg_controldata */
+#define PGCD_NUM_SETTINGS	30
+#define PGCD_SETTING_LEN	128
+
+/*
+ * A standby considered for promotion, see pgcd_rank_candidates().
+ */
+typedef struct pgcdCandidate
+{
+	const char	   *datadir;
+	bool			ok;				/* control file read and verified */
+	char			error[PGCD_ERRBUF_SIZE];
+	ControlFileData	control;
+	TimeLineID		timeline;		/* of the latest restartpoint */
+	int64			replay_pos;		/* WAL known to be replayed */
+	int64			restartpoint_pos;
+	int64			gap;			/* bytes behind the best candidate */
+	int				rank;			/* 1 is best; 0 if unusable */
+} pgcdCandidate;
+
+/*
+ * Whether the WAL archive holds the segments needed to start from a
+ * cluster's latest checkpoint, see pgcd_check_archive().  Offsets are
+ * within the named segments.
+ */
+typedef struct pgcdArchiveCheck
+{
+	bool			ok;
+	char			error[PGCD_ERRBUF_SIZE];
+	char			redo_segment[MAXFNAMELEN];
+	uint32			redo_offset;
+	char			checkpoint_segment[MAXFNAMELEN];
+	uint32			checkpoint_offset;
+	bool			compressed;		/* redo segment was found gzipped */
+	int64			bytes_read;		/* decompressed WAL read to decide */
+} pgcdArchiveCheck;
+
+/*
+ * Reads the XLOG_BLCKSZ bytes of the WAL page at linear position pagepos
+ * into page.  On failure it may leave a message in errbuf.
+ */
+typedef bool (*pgcdReadPageFn) (void *arg, int64 pagepos, char *page,
+								char *errbuf, size_t errlen);
+
+/*
+ * Reassembles WAL records from the pages read_page supplies, see
+ * pgcd_wal_read_record().  The caller owns the MAXALIGNed record buffer;
+ * when a record does not fit, rec_needed says how much would.
+ */
+typedef struct pgcdWalReader
+{
+	pgcdReadPageFn	read_page;
+	void		   *arg;
+	char		   *rec;			/* buffer for the record read */
+	uint32			rec_size;		/* ... and its size */
+	uint32			rec_needed;		/* length of the record last looked at */
+	int64			rec_pos;		/* start of the record last read */
+	int64			prev_pos;		/* expected xl_prev, or -1 not to check */
+	int64			page_pos;		/* position of the page held, or -1 */
+	union
+	{
+		XLogPageHeaderData hdr;
+		double		force_align;
+		char		data[XLOG_BLCKSZ];
+	}				page;
+	char			error[PGCD_ERRBUF_SIZE];
+} pgcdWalReader;
+
+extern const char *const pgcd_setting_names[PGCD_NUM_SETTINGS];
+
+#ifdef FRONTEND
+extern void pgcd_init(void);
+#endif
+extern uint32 pgcd_crc32_update(uint32 crc, const void *data, size_t len);
+extern const char *pgcd_dbstate(DBState state);
+extern void pgcd_format_settings(const ControlFileData *cf,
+								 char settings[][PGCD_SETTING_LEN]);
+extern bool pgcd_load_controlfile(const char *datadir, ControlFileData *cf,
+								  char *errbuf, size_t errlen);
+extern bool pgcd_decode_controlfile(const char *image, size_t len,
+									ControlFileData *cf,
+									char *errbuf, size_t errlen);
+extern void pgcd_candidate_load(pgcdCandidate *cand, const char *datadir);
+extern void pgcd_rank_candidates(pgcdCandidate *cands, int n);
+extern void pgcd_wal_reader_init(pgcdWalReader *r, pgcdReadPageFn read_page,
+								 void *arg, char *buf, uint32 size);
+extern bool pgcd_wal_load_page(pgcdWalReader *r, int64 pagepos);
+extern XLogRecord *pgcd_wal_read_record(pgcdWalReader *r, int64 *pos);
+extern bool pgcd_wal_record_crc_ok(const XLogRecord *rec);
+
+/* pgcd_archive.c */
+extern bool pgcd_check_archive(const char *archive_dir,
+							   const ControlFileData *cf,
+							   pgcdArchiveCheck *result);
+
+#endif   /* PGCD_COMMON_H */
@@ -0,0 +1,139 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_failover.c
+ *		Rank local standbys for promotion by their control files.
+ *
+ * The same ranking is available outside the server, where it matters
+ * most during an outage, as "pg_controldata_tool rank".  Inside a backend
+ * the control files are read one after the other; each is a single small
+ * read, so a few dozen standbys still take only milliseconds.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+#include "pg_controldata.h"
+
+
+Datum		pg_controldata_rank_standbys(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_rank_standbys);
+
+
+/*
+ * Rank the clusters in the given data directories, best candidate first.
+ */
+Datum
+pg_controldata_rank_standbys(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	ArrayType		   *arr = PG_GETARG_ARRAYTYPE_P(0);
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	Datum			   *dirs;
+	bool			   *dirnulls;
+	int					ndirs;
+	pgcdCandidate	   *cands;
+	int					n = 0;
+	int					i;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to read other clusters' control files")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	deconstruct_array(arr, TEXTOID, -1, false, 'i',
+					  &dirs, &dirnulls, &ndirs);
+
+	cands = (pgcdCandidate *) palloc(Max(ndirs, 1) * sizeof(pgcdCandidate));
+	for (i = 0; i < ndirs; i++)
+	{
+		if (dirnulls[i])
+			continue;
+		pgcd_candidate_load(&cands[n++], TextDatumGetCString(dirs[i]));
+	}
+
+	pgcd_rank_candidates(cands, n);
+
+	for (i = 0; i < n; i++)
+	{
+		pgcdCandidate *c = &cands[i];
+		Datum		values[8];
+		bool		nulls[8];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[1] = CStringGetTextDatum(c->datadir);
+		if (c->ok)
+		{
+			values[0] = Int32GetDatum(c->rank);
+			values[2] = Int32GetDatum((int32) c->timeline);
+			values[3] = CStringGetTextDatum(pgcd_dbstate(c->control.state));
+			values[4] = Int64GetDatum(c->replay_pos);
+			values[5] = Int64GetDatum(c->restartpoint_pos);
+			values[6] = Int64GetDatum(c->gap);
+			nulls[7] = true;
+		}
+		else
+		{
+			nulls[0] = nulls[2] = nulls[3] = nulls[4] = nulls[5] = nulls[6] = true;
+			values[7] = CStringGetTextDatum(c->error);
+		}
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,358 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_freeze.c
+ *		Estimate the I/O an anti-wraparound vacuum of each table will cost.
+ *
+ * "Latest checkpoint's oldestXID" tells when the anti-wraparound vacuums
+ * will come, not what they will cost.  Such a vacuum reads every heap page
+ * of the table and dirties at least those not marked all-visible in the
+ * visibility map, so the map is what we look at.  One map page covers some
+ * 65000 heap pages; for tables with more map pages than sample_pages we
+ * read that many, evenly spread, and extrapolate.  Map pages are read
+ * through a bulk-read ring one at a time, so memory and buffer cache use
+ * stay small on any number of tables.
+ *
+ * The estimate is a lower bound: all-visible pages may still hold tuples
+ * old enough to be frozen, and index passes are not counted.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/heapam.h"
+#include "access/transam.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_class.h"
+#include "commands/dbcommands.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "postmaster/autovacuum.h"
+#include "storage/bufmgr.h"
+#include "storage/smgr.h"
+#include "utils/builtins.h"
+#include "utils/rel.h"
+#include "utils/tqual.h"
+
+#include "pg_controldata.h"
+
+
+/* the layout of a visibility map page, as in visibilitymap.c */
+#define VM_MAPSIZE				(BLCKSZ - MAXALIGN(SizeOfPageHeaderData))
+#define VM_HEAPBLOCKS_PER_PAGE	((BlockNumber) VM_MAPSIZE * BITS_PER_BYTE)
+
+#define FREEZE_NCOLS	10
+
+typedef struct freeze_rel
+{
+	Oid			relid;
+	TransactionId frozenxid;
+} freeze_rel;
+
+typedef struct freeze_totals
+{
+	int64		max_age;
+	int64		heap_pages;
+	int64		not_all_visible;
+	int64		cost;
+} freeze_totals;
+
+Datum		pg_controldata_freeze_debt(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_freeze_debt);
+
+static int	list_tables(freeze_rel **rels);
+static int64 count_all_visible(Relation rel, BufferAccessStrategy strategy,
+							   BlockNumber heap_pages, int sample_pages,
+							   int *vm_read, bool *sampled);
+
+
+/*
+ * Collect the tables and TOAST tables of this database.
+ */
+static int
+list_tables(freeze_rel **rels)
+{
+	Relation	rel;
+	HeapScanDesc scan;
+	HeapTuple	tup;
+	int			n = 0;
+	int			alloc = 256;
+
+	*rels = (freeze_rel *) palloc(alloc * sizeof(freeze_rel));
+
+	rel = heap_open(RelationRelationId, AccessShareLock);
+	scan = heap_beginscan(rel, SnapshotNow, 0, NULL);
+
+	while ((tup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(tup);
+
+		if (classForm->relkind != RELKIND_RELATION &&
+			classForm->relkind != RELKIND_TOASTVALUE)
+			continue;
+
+		if (n >= alloc)
+		{
+			alloc *= 2;
+			*rels = (freeze_rel *) repalloc(*rels, alloc * sizeof(freeze_rel));
+		}
+		(*rels)[n].relid = HeapTupleGetOid(tup);
+		(*rels)[n].frozenxid = classForm->relfrozenxid;
+		n++;
+	}
+
+	heap_endscan(scan);
+	heap_close(rel, AccessShareLock);
+
+	return n;
+}
+
+/*
+ * Count the all-visible heap pages of rel, reading all of its visibility
+ * map or, if that is longer, sample_pages evenly spread pages of it and
+ * extrapolating.  Sets *vm_read to the number of map pages read.
+ */
+static int64
+count_all_visible(Relation rel, BufferAccessStrategy strategy,
+				  BlockNumber heap_pages, int sample_pages,
+				  int *vm_read, bool *sampled)
+{
+	BlockNumber vm_pages;
+	BlockNumber nread;
+	BlockNumber covered = 0;
+	BlockNumber i;
+	int64		visible = 0;
+
+	*vm_read = 0;
+	*sampled = false;
+
+	if (!smgrexists(rel->rd_smgr, VISIBILITYMAP_FORKNUM))
+		return 0;
+
+	/* the map may be shorter than the heap, never usefully longer */
+	vm_pages = smgrnblocks(rel->rd_smgr, VISIBILITYMAP_FORKNUM);
+	vm_pages = Min(vm_pages,
+				   (heap_pages + VM_HEAPBLOCKS_PER_PAGE - 1) / VM_HEAPBLOCKS_PER_PAGE);
+	nread = Min(vm_pages, (BlockNumber) sample_pages);
+
+	for (i = 0; i < nread; i++)
+	{
+		BlockNumber vmblk = (BlockNumber) ((uint64) i * vm_pages / nread);
+		BlockNumber first = vmblk * VM_HEAPBLOCKS_PER_PAGE;
+		BlockNumber nbits = Min(VM_HEAPBLOCKS_PER_PAGE, heap_pages - first);
+		Buffer		buf;
+		unsigned char *map;
+		BlockNumber b;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(rel, VISIBILITYMAP_FORKNUM, vmblk,
+								 RBM_ZERO_ON_ERROR, strategy);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		map = (unsigned char *) PageGetContents(BufferGetPage(buf));
+
+		for (b = 0; b < nbits; b++)
+		{
+			if (map[b / BITS_PER_BYTE] & (1 << (b % BITS_PER_BYTE)))
+				visible++;
+		}
+
+		UnlockReleaseBuffer(buf);
+
+		(*vm_read)++;
+		covered += nbits;
+	}
+
+	if (nread < vm_pages)
+	{
+		uint64		mapped = Min((uint64) heap_pages,
+								 (uint64) vm_pages * VM_HEAPBLOCKS_PER_PAGE);
+
+		visible = (int64) ((double) visible * mapped / covered + 0.5);
+		*sampled = true;
+	}
+
+	return visible;
+}
+
+/*
+ * For each table of this database, the age of its relfrozenxid, how many
+ * more XIDs until autovacuum forces a vacuum of it, its heap pages and the
+ * estimated number of them not all-visible, and what vacuuming it would
+ * cost at the given vacuum cost settings (those of autovacuum by default).
+ * A last row, without relid, sums up the database.
+ */
+Datum
+pg_controldata_freeze_debt(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	int					sample_pages = PG_ARGISNULL(0) ? 64 : PG_GETARG_INT32(0);
+	double				cost_delay;
+	int					cost_limit;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	BufferAccessStrategy strategy;
+	TransactionId		nextxid = ReadNewTransactionId();
+	char			   *datname = get_database_name(MyDatabaseId);
+	freeze_rel		   *rels;
+	freeze_totals		totals;
+	Datum				values[FREEZE_NCOLS];
+	bool				nulls[FREEZE_NCOLS];
+	int					nrels;
+	int					i;
+
+	if (sample_pages < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("sample_pages must be at least 1")));
+
+	if (!PG_ARGISNULL(1))
+		cost_delay = PG_GETARG_FLOAT8(1);
+	else if (autovacuum_vac_cost_delay >= 0)
+		cost_delay = autovacuum_vac_cost_delay;
+	else
+		cost_delay = VacuumCostDelay;
+
+	if (!PG_ARGISNULL(2))
+		cost_limit = PG_GETARG_INT32(2);
+	else if (autovacuum_vac_cost_limit > 0)
+		cost_limit = autovacuum_vac_cost_limit;
+	else
+		cost_limit = VacuumCostLimit;
+
+	if (cost_limit < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("cost_limit must be at least 1")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+	nrels = list_tables(&rels);
+	memset(&totals, 0, sizeof(totals));
+
+	for (i = 0; i < nrels; i++)
+	{
+		Relation	rel;
+		BlockNumber heap_pages;
+		bool		sampled;
+		int			vm_read;
+		int64		visible;
+		int64		not_visible;
+		int64		age;
+		int64		cost;
+
+		/* it may have been dropped meanwhile */
+		rel = try_relation_open(rels[i].relid, AccessShareLock);
+		if (rel == NULL)
+			continue;
+		if (isOtherTempNamespace(RelationGetNamespace(rel)))
+		{
+			relation_close(rel, AccessShareLock);
+			continue;
+		}
+
+		RelationOpenSmgr(rel);
+		heap_pages = smgrnblocks(rel->rd_smgr, MAIN_FORKNUM);
+		visible = count_all_visible(rel, strategy, heap_pages, sample_pages,
+									&vm_read, &sampled);
+		relation_close(rel, AccessShareLock);
+
+		not_visible = heap_pages - visible;
+
+		age = TransactionIdIsNormal(rels[i].frozenxid) ?
+			(int32) (nextxid - rels[i].frozenxid) : 0;
+
+		/* every page is read, the not all-visible ones are dirtied */
+		cost = (int64) heap_pages * VacuumCostPageMiss +
+			not_visible * VacuumCostPageDirty;
+
+		totals.max_age = Max(totals.max_age, age);
+		totals.heap_pages += heap_pages;
+		totals.not_all_visible += not_visible;
+		totals.cost += cost;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = CStringGetTextDatum(datname);
+		values[1] = ObjectIdGetDatum(rels[i].relid);
+		values[2] = Int64GetDatum(age);
+		values[3] = Int64GetDatum((int64) autovacuum_freeze_max_age - age);
+		values[4] = Int64GetDatum((int64) heap_pages);
+		values[5] = Int32GetDatum(vm_read);
+		values[6] = BoolGetDatum(sampled);
+		values[7] = Int64GetDatum(not_visible);
+		values[8] = Int64GetDatum(cost);
+		if (cost_delay > 0)
+			values[9] = Float8GetDatum((double) cost / cost_limit * cost_delay /
+									   (1000.0 * SECS_PER_HOUR));
+		else
+			nulls[9] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	FreeAccessStrategy(strategy);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = CStringGetTextDatum(datname);
+	nulls[1] = true;
+	values[2] = Int64GetDatum(totals.max_age);
+	values[3] = Int64GetDatum((int64) autovacuum_freeze_max_age - totals.max_age);
+	values[4] = Int64GetDatum(totals.heap_pages);
+	nulls[5] = nulls[6] = true;
+	values[7] = Int64GetDatum(totals.not_all_visible);
+	values[8] = Int64GetDatum(totals.cost);
+	if (cost_delay > 0)
+		values[9] = Float8GetDatum((double) totals.cost / cost_limit * cost_delay /
+								   (1000.0 * SECS_PER_HOUR));
+	else
+		nulls[9] = true;
+
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
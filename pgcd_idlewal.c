@@ -0,0 +1,169 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_idlewal.c
+ *		Estimate the WAL archive space wasted by forced segment switches.
+ *
+ * With archive_timeout set, a mostly idle cluster switches to a new WAL
+ * segment whenever anything at all was written since the last switch, and
+ * the archive stores the whole segment.  On such a cluster the WAL between
+ * two checkpoints is little more than the first checkpoint's record, the
+ * switch record and, in the new segment, whatever precedes the second
+ * checkpoint's redo point.  From the redo and checkpoint locations in the
+ * snapshot history we can thus tell the payload apart from the padding.
+ *
+ * An interval is only counted as switched if it looks idle: both redo
+ * points sit near the start of their segments, the first checkpoint's
+ * record follows its redo point closely, and no more segment boundaries
+ * were crossed than archive_timeout could have forced.  The boundary count
+ * alone says little, as a busy interval as long as a few archive_timeouts
+ * passes it too; in such intervals segments also filled up and the
+ * estimate would not hold.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/htup.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "funcapi.h"
+
+#include "pg_controldata.h"
+
+
+/* size of a checkpoint record, header included */
+#define CHECKPOINT_RECORD_SIZE	MAXALIGN(SizeOfXLogRecord + sizeof(CheckPoint))
+
+/*
+ * WAL within this fraction of a segment from a redo point or segment start
+ * is taken for the trickle of an idle cluster.
+ */
+#define IDLE_SEGMENT_FRACTION	64
+
+Datum		pg_controldata_switch_waste(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_switch_waste);
+
+
+/*
+ * Sum up the segments switched by archive_timeout over the checkpoints in
+ * the snapshot history, their payload and the padding archived with them,
+ * and extrapolate the totals to one day.
+ */
+Datum
+pg_controldata_switch_waste(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[10];
+	bool		nulls[10];
+	pgcdSnapshot *ckpts;
+	int			nckpts;
+	int			i;
+	int32		intervals = 0;
+	int64		seconds = 0;
+	int64		switched = 0;
+	int64		payload = 0;
+	int64		archived = 0;
+
+	if (!pgcd)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	nckpts = pgcd_history_checkpoints(&ckpts);
+
+	for (i = 1; i < nckpts; i++)
+	{
+		const ControlFileData *prev = &ckpts[i - 1].control;
+		const ControlFileData *cur = &ckpts[i].control;
+		int64		segsize = cur->xlog_seg_size;
+		int64		redo0 = PGCD_LSN_POS(prev->checkPointCopy.redo);
+		int64		redo1 = PGCD_LSN_POS(cur->checkPointCopy.redo);
+		int64		elapsed = cur->checkPointCopy.time - prev->checkPointCopy.time;
+		int64		idle = segsize / IDLE_SEGMENT_FRACTION;
+		int64		crossed;
+		int64		bytes;
+
+		/* across a timeline switch or a restored backup, the LSNs say nothing */
+		if (redo1 < redo0 || elapsed <= 0 ||
+			cur->checkPointCopy.ThisTimeLineID != prev->checkPointCopy.ThisTimeLineID)
+			continue;
+
+		intervals++;
+		seconds += elapsed;
+
+		crossed = redo1 / segsize - redo0 / segsize;
+		if (crossed == 0 || XLogArchiveTimeout <= 0 ||
+			crossed > elapsed / XLogArchiveTimeout)
+			continue;
+
+		/* no evidence the segments were forced rather than filled */
+		if (redo0 % segsize > idle || redo1 % segsize > idle ||
+			PGCD_LSN_POS(prev->checkPoint) - redo0 > idle)
+			continue;
+
+		/*
+		 * The first checkpoint's records and the switch record, then the
+		 * new segment up to the second redo point, less its page header.
+		 * Segments in between held a switch record each.
+		 */
+		bytes = PGCD_LSN_POS(prev->checkPoint) - redo0 +
+			CHECKPOINT_RECORD_SIZE + SizeOfXLogRecord;
+		bytes += Max(redo1 % segsize - (int64) SizeOfXLogLongPHD, 0);
+		bytes += (crossed - 1) * (SizeOfXLogLongPHD + SizeOfXLogRecord);
+
+		switched += crossed;
+		archived += crossed * segsize;
+		payload += Min(bytes, crossed * segsize);
+	}
+
+	pfree(ckpts);
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = Int32GetDatum(XLogArchiveTimeout);
+	values[1] = Int32GetDatum(intervals);
+	values[2] = Int64GetDatum(seconds);
+	values[3] = Int64GetDatum(switched);
+	values[4] = Int64GetDatum(archived);
+	values[5] = Int64GetDatum(payload);
+	values[6] = Int64GetDatum(archived - payload);
+
+	if (seconds > 0)
+	{
+		double		per_day = (double) SECS_PER_DAY / seconds;
+
+		values[7] = Float8GetDatum(switched * per_day);
+		values[8] = Float8GetDatum(archived * per_day);
+		values[9] = Float8GetDatum((archived - payload) * per_day);
+	}
+	else
+		nulls[7] = nulls[8] = nulls[9] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
@@ -0,0 +1,262 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_limits.c
+ *		Project when each counter in the control file reaches its limit.
+ *
+ * The XID counter runs into the autovacuum, warning and stop limits
+ * derived from oldestXID; the XID epoch, NextMultiXactId,
+ * NextMultiOffset and NextOID wrap around at 2^32.  9.0 has no wraparound
+ * protection for the latter three, so their limit is where they wrap.
+ *
+ * One pass over the checkpoints in the snapshot history fits a rate for
+ * every counter at once, the wrapped ones unwrapped on the way, rather than
+ * a regression query per counter.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/transam.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "postmaster/autovacuum.h"
+#include "utils/builtins.h"
+
+#include "pg_controldata.h"
+
+
+#define WRAP			((int64) 1 << 32)
+
+/* ETAs further out than this many seconds are left NULL */
+#define ETA_HORIZON		(1000.0 * 365.25 * SECS_PER_DAY)
+
+/* the series fitted, all as 64-bit values */
+typedef enum limit_series
+{
+	SERIES_XID,					/* NextXID with epoch */
+	SERIES_MULTI,				/* NextMultiXactId, unwrapped */
+	SERIES_OFFSET,				/* NextMultiOffset, unwrapped */
+	SERIES_OID,					/* NextOID, unwrapped */
+	NUM_SERIES
+} limit_series;
+
+Datum		pg_controldata_limits(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_limits);
+
+static void series_values(const CheckPoint *ckpt, uint32 *raw);
+static void emit_limit(Tuplestorestate *tupstore, TupleDesc tupdesc,
+					   const char *counter, int64 current, double rate,
+					   int64 limit, pg_time_t as_of, int samples);
+
+
+/*
+ * The current values of the series; the XID in its low 32 bits.
+ */
+static void
+series_values(const CheckPoint *ckpt, uint32 *raw)
+{
+	raw[SERIES_XID] = ckpt->nextXid;
+	raw[SERIES_MULTI] = ckpt->nextMulti;
+	raw[SERIES_OFFSET] = ckpt->nextMultiOffset;
+	raw[SERIES_OID] = ckpt->nextOid;
+}
+
+/*
+ * Add a row for one counter; current and limit as of the checkpoint at
+ * as_of, rate per second or NaN if unknown.
+ */
+static void
+emit_limit(Tuplestorestate *tupstore, TupleDesc tupdesc, const char *counter,
+		   int64 current, double rate, int64 limit, pg_time_t as_of,
+		   int samples)
+{
+	Datum		values[8];
+	bool		nulls[8];
+	double		seconds;
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = CStringGetTextDatum(counter);
+	values[1] = Int64GetDatum(current);
+	values[3] = Int64GetDatum(limit);
+	values[4] = Int64GetDatum(limit - current);
+	values[7] = Int32GetDatum(samples);
+
+	if (isnan(rate))
+		nulls[2] = true;
+	else
+		values[2] = Float8GetDatum(rate);
+
+	if (isnan(rate) || rate <= 0)
+	{
+		nulls[5] = nulls[6] = true;
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		return;
+	}
+
+	seconds = Max(limit - current, 0) / rate;
+	values[5] = Float8GetDatum(seconds);
+
+	if (seconds <= ETA_HORIZON)
+	{
+		TimestampTz eta = time_t_to_timestamptz(as_of);
+
+#ifdef HAVE_INT64_TIMESTAMP
+		eta += (int64) (seconds * USECS_PER_SEC);
+#else
+		eta += seconds;
+#endif
+		values[6] = TimestampTzGetDatum(eta);
+	}
+	else
+		nulls[6] = true;
+
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
+
+/*
+ * One row per counter and limit with the counter's current value, its rate
+ * over the checkpoints in the snapshot history, the limit, what remains of
+ * it, and when it will be reached at that rate.
+ */
+Datum
+pg_controldata_limits(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	pgcdSnapshot	   *ckpts;
+	pgcdRegrState		regr[NUM_SERIES];
+	uint32				raw[NUM_SERIES];
+	uint32				prev[NUM_SERIES];
+	int64				wraps[NUM_SERIES];
+	double				rate[NUM_SERIES];
+	const CheckPoint   *last;
+	int64				full_xid;
+	int64				full_oldest;
+	int					nckpts;
+	int					i;
+	int					s;
+
+	if (!pgcd)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	nckpts = pgcd_history_checkpoints(&ckpts);
+	if (nckpts == 0)
+	{
+		pfree(ckpts);
+		tuplestore_donestoring(tupstore);
+		return (Datum) 0;
+	}
+
+	memset(regr, 0, sizeof(regr));
+	memset(wraps, 0, sizeof(wraps));
+	memset(prev, 0, sizeof(prev));
+
+	for (i = 0; i < nckpts; i++)
+	{
+		const CheckPoint *ckpt = &ckpts[i].control.checkPointCopy;
+
+		series_values(ckpt, raw);
+
+		/* the XID comes with its epoch; the others wrap silently */
+		wraps[SERIES_XID] = ckpt->nextXidEpoch;
+		for (s = SERIES_XID + 1; s < NUM_SERIES; s++)
+		{
+			if (i > 0 && raw[s] < prev[s])
+				wraps[s]++;
+			prev[s] = raw[s];
+		}
+
+		for (s = 0; s < NUM_SERIES; s++)
+			pgcd_regr_add(&regr[s], (double) ckpt->time,
+						  wraps[s] * WRAP + raw[s]);
+	}
+
+	for (s = 0; s < NUM_SERIES; s++)
+	{
+		if (regr[s].n >= 2 && regr[s].sxx > 0)
+			rate[s] = regr[s].sxy / regr[s].sxx;
+		else
+			rate[s] = get_float8_nan();
+	}
+
+	last = &ckpts[nckpts - 1].control.checkPointCopy;
+	full_xid = PGCD_FULL_XID(last->nextXidEpoch, last->nextXid);
+	full_oldest = PGCD_FULL_XID(last->nextXidEpoch -
+								(last->oldestXid > last->nextXid ? 1 : 0),
+								last->oldestXid);
+
+	/* as in SetTransactionIdLimit() */
+	emit_limit(tupstore, tupdesc, "xid autovacuum", full_xid, rate[SERIES_XID],
+			   full_oldest + autovacuum_freeze_max_age, last->time, nckpts);
+	emit_limit(tupstore, tupdesc, "xid warn", full_xid, rate[SERIES_XID],
+			   full_oldest + (MaxTransactionId >> 1) - 11000000,
+			   last->time, nckpts);
+	emit_limit(tupstore, tupdesc, "xid stop", full_xid, rate[SERIES_XID],
+			   full_oldest + (MaxTransactionId >> 1) - 1000000,
+			   last->time, nckpts);
+	emit_limit(tupstore, tupdesc, "xid epoch", last->nextXidEpoch,
+			   rate[SERIES_XID] / WRAP, WRAP, last->time, nckpts);
+	emit_limit(tupstore, tupdesc, "multixact", last->nextMulti,
+			   rate[SERIES_MULTI], WRAP, last->time, nckpts);
+	emit_limit(tupstore, tupdesc, "multixact offset", last->nextMultiOffset,
+			   rate[SERIES_OFFSET], WRAP, last->time, nckpts);
+	emit_limit(tupstore, tupdesc, "oid", last->nextOid,
+			   rate[SERIES_OID], WRAP, last->time, nckpts);
+
+	pfree(ckpts);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
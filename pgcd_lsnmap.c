@@ -0,0 +1,296 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_lsnmap.c
+ *		Translate between WAL positions and wall-clock time using the
+ *		checkpoints seen by the sampler.
+ *
+ * Every checkpoint records the WAL insert position at its start (the redo
+ * location) together with its start time, which gives one exact
+ * (position, time) pair per checkpoint.  We collect those pairs from the
+ * snapshot history into an array sorted by position, drop anything that
+ * would make time go backwards, and answer lookups in either direction by
+ * binary search and linear interpolation between neighbours.  Outside of
+ * recovery the current insert position and time serve as one more point,
+ * so positions newer than the latest checkpoint can be placed too.
+ *
+ * The array is built in backend-local memory and only rebuilt when the
+ * sampler has recorded new snapshots.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xlog.h"
+#include "fmgr.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include "pg_controldata.h"
+
+
+typedef struct pgcdLsnPoint
+{
+	int64		pos;
+	TimestampTz	time;
+} pgcdLsnPoint;
+
+/* backend-local map, valid for snapshots up to lsnmap_version */
+static pgcdLsnPoint *lsnmap = NULL;
+static int	lsnmap_len = 0;
+static uint64 lsnmap_version = 0;
+
+static int	point_cmp(const void *a, const void *b);
+static void lsnmap_refresh(void);
+static int	lsnmap_points(pgcdLsnPoint *tail);
+
+Datum		pg_controldata_lsn(PG_FUNCTION_ARGS);
+Datum		pg_controldata_lsn_pos(PG_FUNCTION_ARGS);
+Datum		pg_controldata_lsn_time(PG_FUNCTION_ARGS);
+Datum		pg_controldata_time_lsn(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_lsn);
+PG_FUNCTION_INFO_V1(pg_controldata_lsn_pos);
+PG_FUNCTION_INFO_V1(pg_controldata_lsn_time);
+PG_FUNCTION_INFO_V1(pg_controldata_time_lsn);
+
+
+static int
+point_cmp(const void *a, const void *b)
+{
+	const pgcdLsnPoint *pa = (const pgcdLsnPoint *) a;
+	const pgcdLsnPoint *pb = (const pgcdLsnPoint *) b;
+
+	if (pa->pos != pb->pos)
+		return (pa->pos < pb->pos) ? -1 : 1;
+	if (pa->time != pb->time)
+		return (pa->time < pb->time) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Rebuild the map if the sampler has recorded anything since last time.
+ */
+static void
+lsnmap_refresh(void)
+{
+	pgcdSnapshot *snaps;
+	pgcdLsnPoint *points;
+	uint64		version;
+	int			count;
+	int			n = 0;
+	int			i;
+
+	LWLockAcquire(pgcd->lock, LW_SHARED);
+	version = pgcd->nsnapshots;
+	LWLockRelease(pgcd->lock);
+
+	if (lsnmap && version == lsnmap_version)
+		return;
+
+	count = pgcd_history_copy(&snaps);
+
+	points = (pgcdLsnPoint *)
+		MemoryContextAlloc(TopMemoryContext,
+						   Max(count, 1) * sizeof(pgcdLsnPoint));
+	for (i = 0; i < count; i++)
+	{
+		points[i].pos = PGCD_LSN_POS(snaps[i].control.checkPointCopy.redo);
+		points[i].time =
+			time_t_to_timestamptz(snaps[i].control.checkPointCopy.time);
+	}
+	pfree(snaps);
+
+	qsort(points, count, sizeof(pgcdLsnPoint), point_cmp);
+
+	/* keep strictly increasing positions with non-decreasing times */
+	for (i = 0; i < count; i++)
+	{
+		if (n > 0 &&
+			(points[i].pos == points[n - 1].pos ||
+			 points[i].time < points[n - 1].time))
+			continue;
+		points[n++] = points[i];
+	}
+
+	if (lsnmap)
+		pfree(lsnmap);
+	lsnmap = points;
+	lsnmap_len = n;
+	lsnmap_version = version;
+}
+
+/*
+ * Refresh the map and work out the live tail point.  Returns the number of
+ * usable points including the tail, which is only valid if the result
+ * exceeds lsnmap_len.
+ */
+static int
+lsnmap_points(pgcdLsnPoint *tail)
+{
+	if (!pgcd)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	lsnmap_refresh();
+
+	if (RecoveryInProgress())
+		return lsnmap_len;
+
+	tail->pos = PGCD_LSN_POS(GetInsertRecPtr());
+	tail->time = GetCurrentTimestamp();
+
+	if (lsnmap_len > 0 &&
+		(tail->pos <= lsnmap[lsnmap_len - 1].pos ||
+		 tail->time < lsnmap[lsnmap_len - 1].time))
+		return lsnmap_len;
+
+	return lsnmap_len + 1;
+}
+
+/* i-th point of the map, the live tail coming after the last one */
+#define POINT(i)	((i) < lsnmap_len ? &lsnmap[i] : &tail)
+
+/*
+ * Estimated time at which the given WAL byte position was written.
+ */
+Datum
+pg_controldata_lsn_time(PG_FUNCTION_ARGS)
+{
+	int64		pos = PG_GETARG_INT64(0);
+	pgcdLsnPoint tail;
+	const pgcdLsnPoint *lo;
+	const pgcdLsnPoint *hi;
+	int			n;
+	int			l;
+	int			h;
+
+	n = lsnmap_points(&tail);
+
+	if (n == 0 || pos < POINT(0)->pos || pos > POINT(n - 1)->pos)
+		PG_RETURN_NULL();
+
+	/* find the first point at or after pos */
+	l = 0;
+	h = n - 1;
+	while (l < h)
+	{
+		int			m = (l + h) / 2;
+
+		if (POINT(m)->pos < pos)
+			l = m + 1;
+		else
+			h = m;
+	}
+
+	hi = POINT(l);
+	if (hi->pos == pos || l == 0)
+		PG_RETURN_TIMESTAMPTZ(hi->time);
+	lo = POINT(l - 1);
+
+	PG_RETURN_TIMESTAMPTZ(lo->time + (TimestampTz)
+						  ((double) (hi->time - lo->time) *
+						   (double) (pos - lo->pos) /
+						   (double) (hi->pos - lo->pos)));
+}
+
+/*
+ * Estimated WAL byte position that was current at the given time.
+ */
+Datum
+pg_controldata_time_lsn(PG_FUNCTION_ARGS)
+{
+	TimestampTz	t = PG_GETARG_TIMESTAMPTZ(0);
+	pgcdLsnPoint tail;
+	const pgcdLsnPoint *lo;
+	const pgcdLsnPoint *hi;
+	int			n;
+	int			l;
+	int			h;
+
+	n = lsnmap_points(&tail);
+
+	if (n == 0 || t < POINT(0)->time || t > POINT(n - 1)->time)
+		PG_RETURN_NULL();
+
+	/* find the first point at or after t */
+	l = 0;
+	h = n - 1;
+	while (l < h)
+	{
+		int			m = (l + h) / 2;
+
+		if (POINT(m)->time < t)
+			l = m + 1;
+		else
+			h = m;
+	}
+
+	hi = POINT(l);
+	if (hi->time == t || l == 0)
+		PG_RETURN_INT64(hi->pos);
+	lo = POINT(l - 1);
+
+	PG_RETURN_INT64(lo->pos + (int64)
+					((double) (hi->pos - lo->pos) *
+					 (double) (t - lo->time) /
+					 (double) (hi->time - lo->time)));
+}
+
+/*
+ * Convert a linear byte position back to the usual X/X notation.
+ */
+Datum
+pg_controldata_lsn(PG_FUNCTION_ARGS)
+{
+	int64		pos = PG_GETARG_INT64(0);
+	char		buf[32];
+
+	if (pos < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("WAL position must not be negative")));
+
+	snprintf(buf, sizeof(buf), "%X/%X",
+			 (uint32) (pos / XLogFileSize), (uint32) (pos % XLogFileSize));
+
+	PG_RETURN_TEXT_P(cstring_to_text(buf));
+}
+
+/*
+ * Convert X/X notation, as returned by pg_current_xlog_location() and
+ * friends, to a linear byte position.
+ */
+Datum
+pg_controldata_lsn_pos(PG_FUNCTION_ARGS)
+{
+	char	   *str = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	XLogRecPtr	ptr;
+
+	if (sscanf(str, "%X/%X", &ptr.xlogid, &ptr.xrecoff) != 2)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid WAL location: \"%s\"", str)));
+
+	PG_RETURN_INT64(PGCD_LSN_POS(ptr));
+}
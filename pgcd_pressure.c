@@ -0,0 +1,410 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_pressure.c
+ *		Linux I/O pressure (PSI) sampled alongside pg_control.
+ *
+ * Every time the sampler reads pg_control it also reads the cumulative
+ * stall times ("total=", in microseconds) from /proc/pressure/io and, when
+ * the server runs in a cgroup v2 hierarchy, from the cgroup's io.pressure,
+ * into a ring of its own.  Since the totals only ever grow, the stall
+ * percentage over any interval covered by the ring is the difference of
+ * the totals, interpolated at its ends, divided by its length.
+ *
+ * pg_controldata_checkpoint_pressure() evaluates that for every checkpoint
+ * in the snapshot history, from its start to the control file update that
+ * ended it, and for the quiet interval before it, which is what the
+ * checkpoint's figures have to be compared with.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+
+#include "pg_controldata.h"
+
+
+#define HOST_PRESSURE_FILE		"/proc/pressure/io"
+#define CGROUP_FILE				"/proc/self/cgroup"
+#define CGROUP_MOUNT			"/sys/fs/cgroup"
+
+/* the four totals kept per sample */
+#define PSI_HOST_SOME	0
+#define PSI_HOST_FULL	1
+#define PSI_CG_SOME		2
+#define PSI_CG_FULL		3
+#define PSI_NUM			4
+
+typedef struct pgcdPressureSample
+{
+	TimestampTz		time;
+	int64			total[PSI_NUM];	/* stall usecs, or -1 if unavailable */
+} pgcdPressureSample;
+
+/*
+ * Sample number n lives in ring[n % ring_size], like the snapshot ring.
+ */
+typedef struct pgcdPressureState
+{
+	LWLockId		lock;
+	char			cgroup_file[MAXPGPATH];	/* io.pressure, or empty */
+	uint64			nsamples;
+	int				ring_size;
+	pgcdPressureSample ring[1];		/* VARIABLE LENGTH ARRAY */
+} pgcdPressureState;
+
+/* GUC variables */
+int			pgcd_pressure_samples;
+
+static pgcdPressureState *pressure = NULL;
+
+static bool read_pressure(const char *path, int64 *some, int64 *full);
+static void find_cgroup_file(char *result);
+static double total_at(const pgcdPressureSample *samples, int n,
+					   TimestampTz t, int which);
+static void stall_pct(const pgcdPressureSample *samples, int n,
+					  TimestampTz start, TimestampTz end,
+					  Datum *values, bool *nulls);
+
+Datum		pg_controldata_checkpoint_pressure(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_checkpoint_pressure);
+
+
+/*
+ * Define GUCs; called from _PG_init.
+ */
+void
+pgcd_pressure_init(void)
+{
+	DefineCustomIntVariable("pg_controldata.pressure_samples",
+		"Sets the number of I/O pressure samples kept in shared memory.",
+							"Zero disables I/O pressure sampling.",
+							&pgcd_pressure_samples,
+							3600,
+							0,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL);
+}
+
+/*
+ * Estimate shared memory space needed.
+ */
+Size
+pgcd_pressure_shmem_size(void)
+{
+	Size		size;
+
+	size = offsetof(pgcdPressureState, ring);
+	size = add_size(size, mul_size(Max(pgcd_pressure_samples, 1),
+								   sizeof(pgcdPressureSample)));
+
+	return size;
+}
+
+/*
+ * Allocate or attach to shared memory; caller holds AddinShmemInitLock.
+ */
+void
+pgcd_pressure_shmem_startup(void)
+{
+	bool		found;
+
+	pressure = ShmemInitStruct("pg_controldata pressure",
+							   pgcd_pressure_shmem_size(),
+							   &found);
+
+	if (!found)
+	{
+		pressure->lock = LWLockAssign();
+		pressure->nsamples = 0;
+		pressure->ring_size = pgcd_pressure_samples;
+		find_cgroup_file(pressure->cgroup_file);
+	}
+}
+
+/*
+ * Parse the "total=" fields of the "some" and "full" lines of a PSI file.
+ */
+static bool
+read_pressure(const char *path, int64 *some, int64 *full)
+{
+	FILE	   *fp;
+	char		line[256];
+
+	*some = *full = -1;
+
+	fp = AllocateFile(path, "r");
+	if (!fp)
+		return false;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char	   *p = strstr(line, "total=");
+		int64	   *dest;
+
+		if (strncmp(line, "some ", 5) == 0)
+			dest = some;
+		else if (strncmp(line, "full ", 5) == 0)
+			dest = full;
+		else
+			continue;
+
+		if (p)
+			*dest = strtoll(p + 6, NULL, 10);
+	}
+
+	FreeFile(fp);
+
+	return *some >= 0;
+}
+
+/*
+ * Locate the io.pressure file of our cgroup v2 ("0::/path" line), if any.
+ */
+static void
+find_cgroup_file(char *result)
+{
+	FILE	   *fp;
+	char		line[MAXPGPATH];
+	int64		some;
+	int64		full;
+
+	result[0] = '\0';
+
+	fp = AllocateFile(CGROUP_FILE, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (strncmp(line, "0::", 3) == 0)
+		{
+			line[strcspn(line, "\n")] = '\0';
+			snprintf(result, MAXPGPATH, "%s%s/io.pressure",
+					 CGROUP_MOUNT, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+			break;
+		}
+	}
+
+	FreeFile(fp);
+
+	if (result[0] != '\0' && !read_pressure(result, &some, &full))
+		result[0] = '\0';
+}
+
+/*
+ * Read the pressure files; called by the sampler together with pg_control.
+ */
+void
+pgcd_pressure_sample(TimestampTz now)
+{
+	pgcdPressureSample sample;
+
+	if (!pressure || pressure->ring_size <= 0)
+		return;
+
+	sample.time = now;
+	read_pressure(HOST_PRESSURE_FILE,
+				  &sample.total[PSI_HOST_SOME], &sample.total[PSI_HOST_FULL]);
+	if (pressure->cgroup_file[0] != '\0')
+		read_pressure(pressure->cgroup_file,
+					  &sample.total[PSI_CG_SOME], &sample.total[PSI_CG_FULL]);
+	else
+		sample.total[PSI_CG_SOME] = sample.total[PSI_CG_FULL] = -1;
+
+	/* no PSI on this kernel; don't fill the ring with nothing */
+	if (sample.total[PSI_HOST_SOME] < 0 && sample.total[PSI_CG_SOME] < 0)
+		return;
+
+	LWLockAcquire(pressure->lock, LW_EXCLUSIVE);
+	pressure->ring[pressure->nsamples % pressure->ring_size] = sample;
+	pressure->nsamples++;
+	LWLockRelease(pressure->lock);
+}
+
+/*
+ * Stall total at time t, interpolated between the samples around it; -1 if
+ * t is not covered or the total is unavailable there.
+ */
+static double
+total_at(const pgcdPressureSample *samples, int n, TimestampTz t, int which)
+{
+	int			lo = 0;
+	int			hi = n - 1;
+	const pgcdPressureSample *a;
+	const pgcdPressureSample *b;
+
+	if (n == 0 || t < samples[0].time || t > samples[n - 1].time)
+		return -1;
+
+	/* find the last sample at or before t */
+	while (lo < hi)
+	{
+		int			mid = (lo + hi + 1) / 2;
+
+		if (samples[mid].time <= t)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	a = &samples[lo];
+	b = (lo + 1 < n) ? &samples[lo + 1] : a;
+
+	if (a->total[which] < 0 || b->total[which] < 0)
+		return -1;
+	if (b->time == a->time)
+		return (double) a->total[which];
+
+	return a->total[which] + (double) (b->total[which] - a->total[which]) *
+		(t - a->time) / (b->time - a->time);
+}
+
+/*
+ * Fill values[0..PSI_NUM-1] with the stall percentages over [start, end].
+ */
+static void
+stall_pct(const pgcdPressureSample *samples, int n,
+		  TimestampTz start, TimestampTz end, Datum *values, bool *nulls)
+{
+	int			i;
+
+	for (i = 0; i < PSI_NUM; i++)
+	{
+		double		t0 = total_at(samples, n, start, i);
+		double		t1 = total_at(samples, n, end, i);
+		double		usecs = (double) (end - start);
+
+#ifndef HAVE_INT64_TIMESTAMP
+		usecs *= USECS_PER_SEC;
+#endif
+
+		if (end <= start || t0 < 0 || t1 < 0)
+			nulls[i] = true;
+		else
+			values[i] = Float8GetDatum(100.0 * (t1 - t0) / usecs);
+	}
+}
+
+/*
+ * I/O stall percentages during each checkpoint in the snapshot history,
+ * and in the interval between its predecessor's end and its start.
+ */
+Datum
+pg_controldata_checkpoint_pressure(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	pgcdSnapshot	   *snaps;
+	pgcdPressureSample *samples;
+	int					nsnaps;
+	int					nsamples = 0;
+	uint64				start;
+	uint64				n;
+	int					i;
+
+	if (!pressure)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* copy the pressure ring, oldest first */
+	LWLockAcquire(pressure->lock, LW_SHARED);
+	start = (pressure->nsamples > (uint64) pressure->ring_size) ?
+		pressure->nsamples - pressure->ring_size : 0;
+	samples = (pgcdPressureSample *)
+		palloc(Max(pressure->nsamples - start, 1) * sizeof(pgcdPressureSample));
+	for (n = start; n < pressure->nsamples; n++)
+		samples[nsamples++] = pressure->ring[n % pressure->ring_size];
+	LWLockRelease(pressure->lock);
+
+	nsnaps = pgcd_history_checkpoints(&snaps);
+
+	for (i = 0; i < nsnaps; i++)
+	{
+		const ControlFileData *cf = &snaps[i].control;
+		TimestampTz	ckpt_start = time_t_to_timestamptz(cf->checkPointCopy.time);
+		TimestampTz	ckpt_end = time_t_to_timestamptz(cf->time);
+		Datum		values[3 + 2 * PSI_NUM];
+		bool		nulls[3 + 2 * PSI_NUM];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int64GetDatum(PGCD_LSN_POS(cf->checkPoint));
+		values[1] = TimestampTzGetDatum(ckpt_start);
+		values[2] = TimestampTzGetDatum(ckpt_end);
+
+		stall_pct(samples, nsamples, ckpt_start, ckpt_end,
+				  values + 3, nulls + 3);
+
+		if (i > 0)
+			stall_pct(samples, nsamples,
+					  time_t_to_timestamptz(snaps[i - 1].control.time),
+					  ckpt_start, values + 3 + PSI_NUM, nulls + 3 + PSI_NUM);
+		else
+			memset(nulls + 3 + PSI_NUM, true, PSI_NUM * sizeof(bool));
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	pfree(snaps);
+	pfree(samples);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,267 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_readahead.c
+ *		The WAL that crash recovery would replay, and the page cache.
+ *
+ * Replay reads WAL one page at a time, synchronously, which is slow on
+ * storage with high read latency.  The postmaster sets up shared memory
+ * right before it starts the startup process, so pgcd_startup.c calls us
+ * from there whenever recovery is coming, and we ask the kernel to start
+ * reading the segments from the redo point onwards.  The hint costs
+ * nothing if the pages are cached already.
+ *
+ * While running, pg_controldata_wal_residency() tells how much of the WAL
+ * from the redo point on is cached right now, which is what a crash
+ * restart would find, and how much a restart after a reboot would have to
+ * read from disk.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include "access/htup.h"
+#include "access/xlog.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+
+#include "pg_controldata.h"
+
+
+/* GUC variables */
+int			pgcd_recovery_readahead;
+
+static int64 resident_bytes(const char *path, off_t start, off_t end);
+
+Datum		pg_controldata_wal_residency(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_wal_residency);
+
+
+/*
+ * Define GUCs; called from _PG_init.
+ */
+void
+pgcd_readahead_init(void)
+{
+	DefineCustomIntVariable("pg_controldata.recovery_readahead",
+		"Sets how much WAL to prefetch from the redo point before recovery.",
+							"Zero disables prefetching.",
+							&pgcd_recovery_readahead,
+							0,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL,
+							NULL);
+}
+
+/*
+ * Ask the kernel to read ahead up to recovery_readahead of WAL, starting at
+ * redo on timeline tli and stopping at the first segment that is not in
+ * pg_xlog; during archive recovery the rest comes from restore_command.
+ * Returns the number of bytes requested.
+ */
+int64
+pgcd_readahead_wal(TimeLineID tli, XLogRecPtr redo)
+{
+	int64		budget = (int64) pgcd_recovery_readahead * 1024;
+	int64		requested = 0;
+
+#if defined(USE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	uint32		log;
+	uint32		seg;
+	off_t		offset;
+
+	if (budget <= 0)
+		return 0;
+
+	XLByteToSeg(redo, log, seg);
+	offset = redo.xrecoff % XLogSegSize;
+
+	while (requested < budget)
+	{
+		char		path[MAXPGPATH];
+		off_t		len = Min(XLogSegSize - offset, budget - requested);
+		int			fd;
+
+		XLogFilePath(path, tli, log, seg);
+
+		fd = BasicOpenFile(path, O_RDONLY | PG_BINARY, 0);
+		if (fd < 0)
+			break;
+
+		(void) posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+		close(fd);
+
+		requested += len;
+		offset = 0;
+		NextLogSeg(log, seg);
+	}
+
+	ereport(LOG,
+			(errmsg("pg_controldata: prefetching " INT64_FORMAT " kB of WAL from %X/%X",
+					requested / 1024, redo.xlogid, redo.xrecoff)));
+#else
+	if (budget > 0)
+		ereport(LOG,
+				(errmsg("pg_controldata.recovery_readahead is not supported on this platform")));
+#endif
+
+	return requested;
+}
+
+/*
+ * Number of bytes of [start, end) of the given file that are in the page
+ * cache, counted in whole pages; 0 if the file cannot be examined.
+ */
+static int64
+resident_bytes(const char *path, off_t start, off_t end)
+{
+	int64		result = 0;
+
+#ifndef WIN32
+	long		pagesize = sysconf(_SC_PAGESIZE);
+	off_t		map_start = start - start % pagesize;
+	size_t		map_len = end - map_start;
+	size_t		npages = (map_len + pagesize - 1) / pagesize;
+	char	   *vec;
+	void	   *addr;
+	int			fd;
+	size_t		i;
+
+	fd = BasicOpenFile((char *) path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		return 0;
+
+	addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, map_start);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return 0;
+
+	vec = palloc(npages);
+	if (mincore(addr, map_len, (void *) vec) == 0)
+	{
+		for (i = 0; i < npages; i++)
+		{
+			off_t		page_start = map_start + (off_t) i * pagesize;
+			off_t		page_end = page_start + pagesize;
+
+			if (!(vec[i] & 1))
+				continue;
+			result += Min(page_end, end) - Max(page_start, start);
+		}
+	}
+	pfree(vec);
+	munmap(addr, map_len);
+#endif
+
+	return result;
+}
+
+/*
+ * Report how much of the WAL from the latest redo point to the current
+ * insert position (on a standby: the minimum recovery point) is cached.
+ * Segments missing from pg_xlog count as cold.  Given the storage's read
+ * rate in bytes/s, also estimate the read time of replay after a reboot
+ * and from the current cache.
+ */
+Datum
+pg_controldata_wal_residency(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[8];
+	bool		nulls[8];
+	ControlFileData cf;
+	TimeLineID	tli;
+	XLogRecPtr	redo;
+	XLogRecPtr	end;
+	int64		total;
+	int64		resident = 0;
+	int64		done = 0;
+	int32		nsegs = 0;
+	uint32		log;
+	uint32		seg;
+	off_t		offset;
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	pgcd_read_controlfile(DataDir, &cf, ERROR);
+
+	tli = cf.checkPointCopy.ThisTimeLineID;
+	redo = cf.checkPointCopy.redo;
+	end = RecoveryInProgress() ? cf.minRecoveryPoint : GetInsertRecPtr();
+
+	total = Max(PGCD_LSN_POS(end) - PGCD_LSN_POS(redo), 0);
+
+	XLByteToSeg(redo, log, seg);
+	offset = redo.xrecoff % XLogSegSize;
+
+	while (done < total)
+	{
+		char		path[MAXPGPATH];
+		off_t		len = Min(XLogSegSize - offset, total - done);
+
+		CHECK_FOR_INTERRUPTS();
+
+		XLogFilePath(path, tli, log, seg);
+		resident += resident_bytes(path, offset, offset + len);
+
+		done += len;
+		nsegs++;
+		offset = 0;
+		NextLogSeg(log, seg);
+	}
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = Int64GetDatum(PGCD_LSN_POS(redo));
+	values[1] = Int64GetDatum(PGCD_LSN_POS(end));
+	values[2] = Int32GetDatum(nsegs);
+	values[3] = Int64GetDatum(total);
+	values[4] = Int64GetDatum(resident);
+	values[5] = Int64GetDatum(total - resident);
+
+	if (!PG_ARGISNULL(0) && PG_GETARG_FLOAT8(0) > 0)
+	{
+		double		rate = PG_GETARG_FLOAT8(0);
+
+		values[6] = Float8GetDatum((total - resident) / rate);
+		values[7] = Float8GetDatum(total / rate);
+	}
+	else
+		nulls[6] = nulls[7] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
@@ -0,0 +1,252 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_results.c
+ *		The rows of pg_controldata(), prebuilt in shared memory.
+ *
+ * Most calls of pg_controldata() see the same control file image as the
+ * call before, yet each would format all settings and form a tuple for
+ * every one of them.  Instead, whoever first sees a new image builds the
+ * (name, setting, staleness) rows as minimal tuples and leaves them in
+ * shared memory, and later calls with the same image only copy them into
+ * their tuplestore.  Staleness differs from call to call, but an interval
+ * is fixed-width, so the rows carry a zero placeholder that each copy has
+ * patched in place.  Installations still using the original two-column
+ * definition get the rows deformed and formed again without it.
+ *
+ * Without shared_preload_libraries, the rows are built for every call.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/htup.h"
+#include "catalog/pg_type.h"
+#include "executor/tuptable.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include "pg_controldata.h"
+
+
+/* room for the rows; a setting is at most PGCD_SETTING_LEN long */
+#define PGCD_RESULTS_SPACE	(PGCD_NUM_SETTINGS * 512)
+
+typedef struct pgcdResults
+{
+	LWLockId		lock;
+	bool			valid;
+	ControlFileData	image;			/* the image the rows were built from */
+	Size			offsets[PGCD_NUM_SETTINGS];
+	Size			stale_offsets[PGCD_NUM_SETTINGS];	/* within each row */
+	char			data[PGCD_RESULTS_SPACE];	/* MAXALIGN'd minimal tuples */
+} pgcdResults;
+
+static pgcdResults *results = NULL;
+
+/* (name text, setting text, staleness interval), in TopMemoryContext */
+static TupleDesc row_desc = NULL;
+
+static void build_rows(const ControlFileData *cf, MinimalTuple *rows,
+					   Size *stale_offsets);
+static void emit_rows(MinimalTuple *rows, const Size *stale_offsets,
+					  Tuplestorestate *tupstore, TupleDesc tupdesc,
+					  const Interval *staleness);
+
+
+/*
+ * Estimate shared memory space needed.
+ */
+Size
+pgcd_results_shmem_size(void)
+{
+	return sizeof(pgcdResults);
+}
+
+/*
+ * Allocate or attach to shared memory; caller holds AddinShmemInitLock.
+ */
+void
+pgcd_results_shmem_startup(void)
+{
+	bool		found;
+
+	results = ShmemInitStruct("pg_controldata results",
+							  pgcd_results_shmem_size(),
+							  &found);
+
+	if (!found)
+	{
+		results->lock = LWLockAssign();
+		results->valid = false;
+	}
+}
+
+/*
+ * Format the settings of cf and form a row for each, in the current memory
+ * context, and note where in each row the staleness placeholder sits.
+ */
+static void
+build_rows(const ControlFileData *cf, MinimalTuple *rows, Size *stale_offsets)
+{
+	char		settings[PGCD_NUM_SETTINGS][PGCD_SETTING_LEN];
+	TupleTableSlot *slot = MakeSingleTupleTableSlot(row_desc);
+	Interval	zero;
+	int			i;
+
+	pgcd_format_settings(cf, settings);
+	memset(&zero, 0, sizeof(zero));
+
+	for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+	{
+		Datum		values[3];
+		bool		nulls[3] = {false, false, false};
+
+		values[0] = CStringGetTextDatum(pgcd_setting_names[i]);
+		values[1] = CStringGetTextDatum(settings[i]);
+		values[2] = IntervalPGetDatum(&zero);
+		rows[i] = heap_form_minimal_tuple(row_desc, values, nulls);
+
+		/* by-reference attributes of a stored tuple point into it */
+		ExecStoreMinimalTuple(rows[i], slot, false);
+		slot_getallattrs(slot);
+		stale_offsets[i] = (char *) DatumGetPointer(slot->tts_values[2]) -
+			(char *) rows[i];
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+}
+
+/*
+ * Append the rows to tupstore with the given staleness, or without it if
+ * tupdesc has only two columns.
+ */
+static void
+emit_rows(MinimalTuple *rows, const Size *stale_offsets,
+		  Tuplestorestate *tupstore, TupleDesc tupdesc,
+		  const Interval *staleness)
+{
+	TupleTableSlot *slot;
+	char	   *copy;
+	uint32		maxlen = 0;
+	int			i;
+
+	if (tupdesc->natts == 2)
+	{
+		slot = MakeSingleTupleTableSlot(row_desc);
+		for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+		{
+			ExecStoreMinimalTuple(rows[i], slot, false);
+			slot_getallattrs(slot);
+			tuplestore_putvalues(tupstore, tupdesc,
+								 slot->tts_values, slot->tts_isnull);
+		}
+		ExecDropSingleTupleTableSlot(slot);
+		return;
+	}
+
+	for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+		maxlen = Max(maxlen, rows[i]->t_len);
+	copy = palloc(maxlen);
+
+	slot = MakeSingleTupleTableSlot(tupdesc);
+	for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+	{
+		memcpy(copy, rows[i], rows[i]->t_len);
+		memcpy(copy + stale_offsets[i], staleness, sizeof(Interval));
+		ExecStoreMinimalTuple((MinimalTuple) copy, slot, false);
+		tuplestore_puttupleslot(tupstore, slot);
+	}
+	ExecDropSingleTupleTableSlot(slot);
+
+	pfree(copy);
+}
+
+/*
+ * Add the rows of pg_controldata() for cf to tupstore, whose descriptor
+ * tupdesc has name and setting and, optionally, the staleness interval.
+ */
+void
+pgcd_results_put(const ControlFileData *cf, Tuplestorestate *tupstore,
+				 TupleDesc tupdesc, const Interval *staleness)
+{
+	MinimalTuple rows[PGCD_NUM_SETTINGS];
+	Size		stale_offsets[PGCD_NUM_SETTINGS];
+	Size		used = 0;
+	int			i;
+
+	if (row_desc == NULL)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+		TupleDesc	desc = CreateTemplateTupleDesc(3, false);
+
+		TupleDescInitEntry(desc, (AttrNumber) 1, "name", TEXTOID, -1, 0);
+		TupleDescInitEntry(desc, (AttrNumber) 2, "setting", TEXTOID, -1, 0);
+		TupleDescInitEntry(desc, (AttrNumber) 3, "staleness",
+						   INTERVALOID, -1, 0);
+		MemoryContextSwitchTo(oldcontext);
+		row_desc = desc;
+	}
+
+	if (results)
+	{
+		LWLockAcquire(results->lock, LW_SHARED);
+		if (results->valid &&
+			memcmp(&results->image, cf, sizeof(ControlFileData)) == 0)
+		{
+			for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+				rows[i] = (MinimalTuple) (results->data + results->offsets[i]);
+			emit_rows(rows, results->stale_offsets, tupstore, tupdesc,
+					  staleness);
+			LWLockRelease(results->lock);
+			return;
+		}
+		LWLockRelease(results->lock);
+	}
+
+	build_rows(cf, rows, stale_offsets);
+	emit_rows(rows, stale_offsets, tupstore, tupdesc, staleness);
+
+	if (!results)
+		return;
+
+	/* leave them for the next caller, if they fit */
+	for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+		used += MAXALIGN(rows[i]->t_len);
+	if (used > PGCD_RESULTS_SPACE)
+		return;
+
+	LWLockAcquire(results->lock, LW_EXCLUSIVE);
+	used = 0;
+	for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+	{
+		results->offsets[i] = used;
+		results->stale_offsets[i] = stale_offsets[i];
+		memcpy(results->data + used, rows[i], rows[i]->t_len);
+		used += MAXALIGN(rows[i]->t_len);
+	}
+	results->image = *cf;
+	results->valid = true;
+	LWLockRelease(results->lock);
+}
@@ -0,0 +1,1012 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_sampler.c
+ *		Shared-memory history of control file snapshots, optionally
+ *		mirrored into a regular table.
+ *
+ * PostgreSQL 9.0 has no background worker infrastructure, so sampling is
+ * piggy-backed on ordinary query execution: at the end of each executor
+ * run the backend checks whether pg_controldata.sample_interval has elapsed
+ * since anybody last looked at pg_control and, if so, reads it.  Images
+ * that differ from the previous one are appended to a ring in shared
+ * memory.
+ *
+ * When pg_controldata.history_table is set, pending snapshots are written
+ * to that table once history_batch_size of them have accumulated, as one
+ * multi-row INSERT per batch inside the transaction of whichever backend
+ * noticed, run as the owner of the table.  The flush is only considered
+ * done once that transaction commits, so an abort, also of a savepoint the
+ * flush ran in, simply leaves the rows pending for the next try.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_class.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/resowner.h"
+#include "utils/syscache.h"
+
+#include "pg_controldata.h"
+
+
+/* GUC variables */
+int			pgcd_history_size;
+int			pgcd_sample_interval;
+char	   *pgcd_history_table = NULL;
+int			pgcd_history_batch;
+int			pgcd_history_retention;
+char	   *pgcd_checkpoint_table = NULL;
+
+/* Saved hook values in case of unload */
+static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
+
+/* true while this backend is running the history INSERT */
+static bool in_flush = false;
+
+/* true while this backend owns pgcd->flush_pid */
+static bool flush_in_flight = false;
+
+/* the subtransaction whose rows the in-flight flush currently belongs to */
+static SubTransactionId flush_subid = InvalidSubTransactionId;
+
+static void pgcd_ExecutorEnd(QueryDesc *queryDesc);
+static void pgcd_xact_callback(XactEvent event, void *arg);
+static void pgcd_subxact_callback(SubXactEvent event,
+								  SubTransactionId mySubid,
+								  SubTransactionId parentSubid,
+								  void *arg);
+static void pgcd_flush_release(bool committed);
+static int	pgcd_history_flush_internal(void);
+static void become_table_owner(const char *target, Oid *save_userid,
+							   int *save_sec_context);
+static void pgcd_maybe_flush(void);
+static void append_snapshot_sql(StringInfo buf, const pgcdSnapshot *snap);
+static char *timestamptz_literal(TimestampTz t);
+static void flush_checkpoints(const pgcdSnapshot *snaps, int count);
+
+/* is a flush target configured? */
+#define TARGET_SET(table)	((table) != NULL && (table)[0] != '\0')
+
+Datum		pg_controldata_history(PG_FUNCTION_ARGS);
+Datum		pg_controldata_history_flush(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_history);
+PG_FUNCTION_INFO_V1(pg_controldata_history_flush);
+
+
+/*
+ * Define GUCs and install hooks; called from _PG_init.
+ */
+void
+pgcd_sampler_init(void)
+{
+	DefineCustomIntVariable("pg_controldata.history_size",
+		 "Sets the number of control file snapshots kept in shared memory.",
+							NULL,
+							&pgcd_history_size,
+							1024,
+							16,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_controldata.sample_interval",
+		   "Sets the minimum time between two reads of pg_control by the sampler.",
+							"Zero disables sampling during query execution.",
+							&pgcd_sample_interval,
+							1000,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MS,
+							NULL,
+							NULL);
+
+	DefineCustomStringVariable("pg_controldata.history_table",
+			  "Sets the table that control file snapshots are copied into.",
+							   "Empty disables copying.",
+							   &pgcd_history_table,
+							   "",
+							   PGC_SUSET,
+							   0,
+							   NULL,
+							   NULL);
+
+	DefineCustomIntVariable("pg_controldata.history_batch_size",
+	  "Sets the number of pending snapshots that triggers a history flush.",
+							NULL,
+							&pgcd_history_batch,
+							32,
+							1,
+							INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_controldata.history_retention",
+			"Sets how long rows are kept in the history table.",
+							"Zero keeps them forever.",
+							&pgcd_history_retention,
+							0,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MIN,
+							NULL,
+							NULL);
+
+	DefineCustomStringVariable("pg_controldata.checkpoint_table",
+		"Sets the table that keeps one summary row per checkpoint.",
+							   "Empty disables it.",
+							   &pgcd_checkpoint_table,
+							   "",
+							   PGC_SUSET,
+							   0,
+							   NULL,
+							   NULL);
+
+	prev_ExecutorEnd = ExecutorEnd_hook;
+	ExecutorEnd_hook = pgcd_ExecutorEnd;
+
+	RegisterXactCallback(pgcd_xact_callback, NULL);
+	RegisterSubXactCallback(pgcd_subxact_callback, NULL);
+}
+
+/*
+ * Estimate shared memory space needed.
+ */
+Size
+pgcd_sampler_shmem_size(void)
+{
+	Size		size;
+
+	size = offsetof(pgcdSharedState, ring);
+	size = add_size(size, mul_size(pgcd_history_size, sizeof(pgcdSnapshot)));
+
+	return size;
+}
+
+/*
+ * Allocate or attach to shared memory; caller holds AddinShmemInitLock.
+ */
+void
+pgcd_sampler_shmem_startup(void)
+{
+	bool		found;
+
+	pgcd = ShmemInitStruct("pg_controldata",
+						   pgcd_sampler_shmem_size(),
+						   &found);
+
+	if (!found)
+	{
+		/* First time through ... */
+		pgcd->lock = LWLockAssign();
+		SpinLockInit(&pgcd->mutex);
+		pgcd->last_sample = 0;
+		pgcd->confirmed = 0;
+		pgcd->nsnapshots = 0;
+		pgcd->nflushed = 0;
+		pgcd->flush_pid = 0;
+		pgcd->flush_upto = 0;
+		pgcd->history_size = pgcd_history_size;
+	}
+}
+
+/*
+ * Record a control file image unless it is identical to the latest one.
+ * Returns true if it was new.
+ */
+bool
+pgcd_observe(const ControlFileData *cf, TimestampTz now)
+{
+	pgcdSnapshot *snap;
+
+	Assert(pgcd);
+
+	LWLockAcquire(pgcd->lock, LW_EXCLUSIVE);
+
+	pgcd->confirmed = now;
+
+	if (pgcd->nsnapshots > 0)
+	{
+		snap = &pgcd->ring[(pgcd->nsnapshots - 1) % pgcd->history_size];
+		if (memcmp(&snap->control, cf, sizeof(ControlFileData)) == 0)
+		{
+			LWLockRelease(pgcd->lock);
+			return false;
+		}
+	}
+
+	snap = &pgcd->ring[pgcd->nsnapshots % pgcd->history_size];
+	snap->observed = now;
+	memcpy(&snap->control, cf, sizeof(ControlFileData));
+	pgcd->nsnapshots++;
+
+	LWLockRelease(pgcd->lock);
+
+	pgcd_startup_observe(cf);
+
+	return true;
+}
+
+/*
+ * Fetch the most recent image and the last time it was known to be
+ * current, without touching pg_control.  Returns false if there is none.
+ */
+bool
+pgcd_latest(ControlFileData *cf, TimestampTz *confirmed)
+{
+	bool		found = false;
+
+	Assert(pgcd);
+
+	LWLockAcquire(pgcd->lock, LW_SHARED);
+
+	if (pgcd->nsnapshots > 0)
+	{
+		memcpy(cf, &pgcd->ring[(pgcd->nsnapshots - 1) % pgcd->history_size].control,
+			   sizeof(ControlFileData));
+		*confirmed = pgcd->confirmed;
+		found = true;
+	}
+
+	LWLockRelease(pgcd->lock);
+
+	return found;
+}
+
+/*
+ * Read pg_control if nobody has done so for sample_interval.
+ *
+ * Only one backend wins each interval; everybody else gets away with a
+ * timestamp comparison under a spinlock.
+ */
+void
+pgcd_maybe_sample(void)
+{
+	volatile pgcdSharedState *s = pgcd;
+	TimestampTz	now;
+	bool		due;
+	ControlFileData cf;
+
+	if (!pgcd || pgcd_sample_interval <= 0 || in_flush)
+		return;
+
+	now = GetCurrentTimestamp();
+
+	SpinLockAcquire(&s->mutex);
+	due = TimestampDifferenceExceeds(s->last_sample, now,
+									 pgcd_sample_interval);
+	if (due)
+		s->last_sample = now;
+	SpinLockRelease(&s->mutex);
+
+	if (!due)
+		return;
+
+	if (pgcd_read_controlfile(DataDir, &cf, LOG))
+	{
+		pgcd_observe(&cf, now);
+		pgcd_alert_evaluate(&cf, now);
+		pgcd_xidwaste_observe(&cf);
+	}
+	pgcd_pressure_sample(now);
+
+	pgcd_maybe_flush();
+}
+
+/*
+ * Copy the retained history, oldest first, into palloc'd memory.
+ */
+int
+pgcd_history_copy(pgcdSnapshot **result)
+{
+	uint64		start;
+	uint64		end;
+	uint64		n;
+	int			count = 0;
+
+	Assert(pgcd);
+
+	LWLockAcquire(pgcd->lock, LW_SHARED);
+
+	end = pgcd->nsnapshots;
+	start = (end > (uint64) pgcd->history_size) ?
+		end - pgcd->history_size : 0;
+
+	*result = (pgcdSnapshot *) palloc(Max(end - start, 1) * sizeof(pgcdSnapshot));
+	for (n = start; n < end; n++)
+		(*result)[count++] = pgcd->ring[n % pgcd->history_size];
+
+	LWLockRelease(pgcd->lock);
+
+	return count;
+}
+
+/*
+ * Like pgcd_history_copy(), but keep only the first snapshot seen for each
+ * distinct checkpoint.  Its control file time is when the checkpoint
+ * finished, give or take the sampling interval, since later updates of
+ * pg_control for the same checkpoint move that time forward.
+ */
+int
+pgcd_history_checkpoints(pgcdSnapshot **result)
+{
+	int			count;
+	int			n = 0;
+	int			i;
+
+	count = pgcd_history_copy(result);
+
+	for (i = 0; i < count; i++)
+	{
+		if (n > 0 &&
+			(*result)[i].control.checkPoint.xlogid ==
+			(*result)[n - 1].control.checkPoint.xlogid &&
+			(*result)[i].control.checkPoint.xrecoff ==
+			(*result)[n - 1].control.checkPoint.xrecoff)
+			continue;
+		(*result)[n++] = (*result)[i];
+	}
+
+	return n;
+}
+
+/*
+ * Convert a snapshot into the typed columns shared by
+ * pg_controldata_history() and the history table.
+ */
+void
+pgcd_snapshot_values(const pgcdSnapshot *snap, Datum *values, bool *nulls)
+{
+	const ControlFileData *cf = &snap->control;
+	const CheckPoint *ckpt = &cf->checkPointCopy;
+	int			i = 0;
+
+	memset(nulls, 0, PGCD_SNAPSHOT_COLS * sizeof(bool));
+
+	values[i++] = TimestampTzGetDatum(snap->observed);
+	values[i++] = CStringGetTextDatum(pgcd_dbstate(cf->state));
+	values[i++] = TimestampTzGetDatum(time_t_to_timestamptz(cf->time));
+	values[i++] = Int64GetDatum(PGCD_LSN_POS(cf->checkPoint));
+	values[i++] = Int64GetDatum(PGCD_LSN_POS(cf->prevCheckPoint));
+	values[i++] = Int64GetDatum(PGCD_LSN_POS(ckpt->redo));
+	values[i++] = Int32GetDatum((int32) ckpt->ThisTimeLineID);
+	values[i++] = Int64GetDatum(PGCD_FULL_XID(ckpt->nextXidEpoch,
+											  ckpt->nextXid));
+	values[i++] = Int64GetDatum((int64) ckpt->nextOid);
+	values[i++] = Int64GetDatum((int64) ckpt->nextMulti);
+	values[i++] = Int64GetDatum((int64) ckpt->nextMultiOffset);
+	values[i++] = Int64GetDatum((int64) ckpt->oldestXid);
+	values[i++] = ObjectIdGetDatum(ckpt->oldestXidDB);
+	values[i++] = Int64GetDatum((int64) ckpt->oldestActiveXid);
+	values[i++] = TimestampTzGetDatum(time_t_to_timestamptz(ckpt->time));
+	values[i++] = Int64GetDatum(PGCD_LSN_POS(cf->minRecoveryPoint));
+	values[i++] = Int64GetDatum(PGCD_LSN_POS(cf->backupStartPoint));
+
+	Assert(i == PGCD_SNAPSHOT_COLS);
+}
+
+/*
+ * Format a timestamp for use in a query run by this same session.
+ */
+static char *
+timestamptz_literal(TimestampTz t)
+{
+	return DatumGetCString(DirectFunctionCall1(timestamptz_out,
+											   TimestampTzGetDatum(t)));
+}
+
+/*
+ * Append one parenthesized VALUES row for snap to buf.
+ *
+ * Everything here is a number or a timestamp we format ourselves, except
+ * the cluster state, which comes from a fixed list without quotes.
+ */
+static void
+append_snapshot_sql(StringInfo buf, const pgcdSnapshot *snap)
+{
+	const ControlFileData *cf = &snap->control;
+	const CheckPoint *ckpt = &cf->checkPointCopy;
+
+	appendStringInfo(buf, "('%s'", timestamptz_literal(snap->observed));
+	appendStringInfo(buf, ",'%s'", pgcd_dbstate(cf->state));
+	appendStringInfo(buf, ",'%s'",
+					 timestamptz_literal(time_t_to_timestamptz(cf->time)));
+	appendStringInfo(buf, "," INT64_FORMAT, PGCD_LSN_POS(cf->checkPoint));
+	appendStringInfo(buf, "," INT64_FORMAT, PGCD_LSN_POS(cf->prevCheckPoint));
+	appendStringInfo(buf, "," INT64_FORMAT, PGCD_LSN_POS(ckpt->redo));
+	appendStringInfo(buf, ",%u", ckpt->ThisTimeLineID);
+	appendStringInfo(buf, "," INT64_FORMAT,
+					 PGCD_FULL_XID(ckpt->nextXidEpoch, ckpt->nextXid));
+	appendStringInfo(buf, ",%u,%u,%u,%u,%u,%u",
+					 ckpt->nextOid, ckpt->nextMulti, ckpt->nextMultiOffset,
+					 ckpt->oldestXid, ckpt->oldestXidDB,
+					 ckpt->oldestActiveXid);
+	appendStringInfo(buf, ",'%s'",
+					 timestamptz_literal(time_t_to_timestamptz(ckpt->time)));
+	appendStringInfo(buf, "," INT64_FORMAT, PGCD_LSN_POS(cf->minRecoveryPoint));
+	appendStringInfo(buf, "," INT64_FORMAT ")",
+					 PGCD_LSN_POS(cf->backupStartPoint));
+}
+
+/*
+ * Switch to the owner of the table target names, so that flushes from the
+ * sampler work whoever's query triggered them, with no more rights than
+ * that owner has.  The name must be schema-qualified, so that it means the
+ * same table whoever's search_path is in effect, and the switch is a
+ * restricted operation, like index functions run by VACUUM, so that the
+ * table's triggers and defaults cannot change the caller's session.  The
+ * previous user is restored by the caller, or by (sub)transaction abort.
+ */
+static void
+become_table_owner(const char *target, Oid *save_userid, int *save_sec_context)
+{
+	RangeVar   *rv;
+	Oid			relid;
+	HeapTuple	tup;
+	Oid			owner;
+
+	rv = makeRangeVarFromNameList(stringToQualifiedNameList(target));
+	if (rv->schemaname == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("table name \"%s\" must be schema-qualified", target),
+				 errhint("Set pg_controldata.history_table and "
+						 "pg_controldata.checkpoint_table to schema.table.")));
+	relid = RangeVarGetRelid(rv, false);
+
+	tup = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tup))
+		elog(ERROR, "cache lookup failed for relation %u", relid);
+	owner = ((Form_pg_class) GETSTRUCT(tup))->relowner;
+	ReleaseSysCache(tup);
+
+	GetUserIdAndSecContext(save_userid, save_sec_context);
+	SetUserIdAndSecContext(owner,
+						   *save_sec_context | SECURITY_LOCAL_USERID_CHANGE |
+						   SECURITY_RESTRICTED_OPERATION);
+}
+
+/*
+ * Add a row to checkpoint_table for every checkpoint among snaps that is
+ * not there yet.  Each row carries what was consumed since the previous
+ * checkpoint of its timeline; for the first one that is the row before it
+ * in the table, fetched once per flush.
+ *
+ * After pg_resetxlog or restoring a base backup, checkpoint positions of a
+ * timeline repeat.  Rows whose (timeline, checkpoint_pos) is taken already
+ * are left out, by the INSERT itself for those in the table and here for
+ * those earlier in this batch, rather than failing this and every later
+ * flush on the primary key.
+ */
+static void
+flush_checkpoints(const pgcdSnapshot *snaps, int count)
+{
+	StringInfoData sql;
+	bool		have_prev = false;
+	int64		prev_ckpt = 0;
+	int64		prev_redo = 0;
+	int64		prev_xid = 0;
+	uint32		prev_oid = 0;
+	uint32		prev_multi = 0;
+	int64	   *done_pos;
+	TimeLineID *done_tli;
+	int			nrows = 0;
+	int			i;
+	int			j;
+
+	if (count == 0)
+		return;
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql,
+					 "SELECT checkpoint_pos, redo_pos, next_xid, next_oid, "
+					 "next_multixact FROM %s "
+					 "WHERE timeline = %u AND checkpoint_pos <= " INT64_FORMAT
+					 " ORDER BY checkpoint_pos DESC LIMIT 1",
+					 pgcd_checkpoint_table,
+					 snaps[0].control.checkPointCopy.ThisTimeLineID,
+					 PGCD_LSN_POS(snaps[0].control.checkPoint));
+	if (SPI_execute(sql.data, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "could not read \"%s\"", pgcd_checkpoint_table);
+
+	if (SPI_processed == 1)
+	{
+		HeapTuple	tup = SPI_tuptable->vals[0];
+		TupleDesc	desc = SPI_tuptable->tupdesc;
+		bool		isnull;
+
+		prev_ckpt = DatumGetInt64(SPI_getbinval(tup, desc, 1, &isnull));
+		prev_redo = DatumGetInt64(SPI_getbinval(tup, desc, 2, &isnull));
+		prev_xid = DatumGetInt64(SPI_getbinval(tup, desc, 3, &isnull));
+		prev_oid = (uint32) DatumGetInt64(SPI_getbinval(tup, desc, 4, &isnull));
+		prev_multi = (uint32) DatumGetInt64(SPI_getbinval(tup, desc, 5, &isnull));
+		have_prev = true;
+	}
+
+	/* VALUES leaves quoted literals and NULLs as text, hence the casts */
+	resetStringInfo(&sql);
+	appendStringInfo(&sql,
+					 "INSERT INTO %s (checkpoint_pos, prior_checkpoint_pos, "
+					 "redo_pos, timeline, start_time, end_time, next_xid, "
+					 "next_oid, next_multixact, wal_bytes, xids, oids, "
+					 "multixacts) "
+					 "SELECT v.checkpoint_pos::bigint, "
+					 "v.prior_checkpoint_pos::bigint, v.redo_pos::bigint, "
+					 "v.timeline::integer, v.start_time::timestamptz, "
+					 "v.end_time::timestamptz, v.next_xid::bigint, "
+					 "v.next_oid::bigint, v.next_multixact::bigint, "
+					 "v.wal_bytes::bigint, v.xids::bigint, v.oids::bigint, "
+					 "v.multixacts::bigint FROM (VALUES ",
+					 pgcd_checkpoint_table);
+
+	done_pos = (int64 *) palloc(count * sizeof(int64));
+	done_tli = (TimeLineID *) palloc(count * sizeof(TimeLineID));
+
+	for (i = 0; i < count; i++)
+	{
+		const ControlFileData *cf = &snaps[i].control;
+		const CheckPoint *ckpt = &cf->checkPointCopy;
+		int64		ckpt_pos = PGCD_LSN_POS(cf->checkPoint);
+		int64		redo_pos = PGCD_LSN_POS(ckpt->redo);
+		int64		next_xid = PGCD_FULL_XID(ckpt->nextXidEpoch,
+											 ckpt->nextXid);
+
+		/* later images of a checkpoint we already have */
+		if (have_prev && ckpt_pos == prev_ckpt)
+			continue;
+
+		/* a position repeated within this batch */
+		for (j = 0; j < nrows; j++)
+		{
+			if (done_pos[j] == ckpt_pos && done_tli[j] == ckpt->ThisTimeLineID)
+				break;
+		}
+
+		if (j == nrows)
+		{
+			done_pos[nrows] = ckpt_pos;
+			done_tli[nrows] = ckpt->ThisTimeLineID;
+
+			if (nrows++ > 0)
+				appendStringInfoChar(&sql, ',');
+
+			/* the first snapshot of a checkpoint is taken right after it ends */
+			appendStringInfo(&sql, "(" INT64_FORMAT "," INT64_FORMAT
+							 "," INT64_FORMAT ",%u",
+							 ckpt_pos, PGCD_LSN_POS(cf->prevCheckPoint),
+							 redo_pos, ckpt->ThisTimeLineID);
+			appendStringInfo(&sql, ",'%s'",
+							 timestamptz_literal(time_t_to_timestamptz(ckpt->time)));
+			appendStringInfo(&sql, ",'%s'",
+							 timestamptz_literal(time_t_to_timestamptz(cf->time)));
+			appendStringInfo(&sql, "," INT64_FORMAT ",%u,%u",
+							 next_xid, ckpt->nextOid, ckpt->nextMulti);
+
+			/* OIDs and multixacts wrap around; uint32 subtraction copes */
+			if (have_prev)
+				appendStringInfo(&sql, "," INT64_FORMAT "," INT64_FORMAT ",%u,%u)",
+								 redo_pos - prev_redo, next_xid - prev_xid,
+								 (uint32) (ckpt->nextOid - prev_oid),
+								 (uint32) (ckpt->nextMulti - prev_multi));
+			else
+				appendStringInfoString(&sql, ",NULL,NULL,NULL,NULL)");
+		}
+
+		have_prev = true;
+		prev_ckpt = ckpt_pos;
+		prev_redo = redo_pos;
+		prev_xid = next_xid;
+		prev_oid = ckpt->nextOid;
+		prev_multi = ckpt->nextMulti;
+	}
+
+	appendStringInfo(&sql,
+					 ") AS v (checkpoint_pos, prior_checkpoint_pos, redo_pos, "
+					 "timeline, start_time, end_time, next_xid, next_oid, "
+					 "next_multixact, wal_bytes, xids, oids, multixacts) "
+					 "WHERE NOT EXISTS (SELECT 1 FROM %s t "
+					 "WHERE t.timeline = v.timeline::integer "
+					 "AND t.checkpoint_pos = v.checkpoint_pos::bigint)",
+					 pgcd_checkpoint_table);
+
+	if (nrows > 0 && SPI_execute(sql.data, false, 0) != SPI_OK_INSERT)
+		elog(ERROR, "could not insert into \"%s\"", pgcd_checkpoint_table);
+
+	pfree(done_pos);
+	pfree(done_tli);
+	pfree(sql.data);
+}
+
+/*
+ * Write all pending snapshots to history_table and checkpoint_table within
+ * the current transaction, then apply the retention policy.  Returns the
+ * number of snapshots written; zero if there was nothing to do or another
+ * backend is busy.
+ */
+static int
+pgcd_history_flush_internal(void)
+{
+	pgcdSnapshot *snaps;
+	uint64		start;
+	uint64		end;
+	uint64		n;
+	int			count = 0;
+	int			i;
+	StringInfoData sql;
+	Oid			save_userid;
+	int			save_sec_context;
+	int			save_nestlevel;
+
+	LWLockAcquire(pgcd->lock, LW_EXCLUSIVE);
+
+	if (pgcd->flush_pid != 0)
+	{
+		LWLockRelease(pgcd->lock);
+		return 0;
+	}
+
+	end = pgcd->nsnapshots;
+	start = Max(pgcd->nflushed,
+				(end > (uint64) pgcd->history_size) ?
+				end - pgcd->history_size : 0);
+	if (start >= end)
+	{
+		LWLockRelease(pgcd->lock);
+		return 0;
+	}
+
+	snaps = (pgcdSnapshot *) palloc((end - start) * sizeof(pgcdSnapshot));
+	for (n = start; n < end; n++)
+		snaps[count++] = pgcd->ring[n % pgcd->history_size];
+
+	pgcd->flush_pid = MyProcPid;
+	pgcd->flush_upto = end;
+	flush_in_flight = true;
+	flush_subid = GetCurrentSubTransactionId();
+
+	LWLockRelease(pgcd->lock);
+
+	/*
+	 * From here on, any error is cleaned up by pgcd_xact_callback() or by
+	 * the subtransaction handling in pgcd_maybe_flush().
+	 */
+	in_flush = true;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	/*
+	 * Whatever the flush does to settings is undone at the end, and our own
+	 * statements see only pg_catalog.
+	 */
+	save_nestlevel = NewGUCNestLevel();
+	(void) set_config_option("search_path", "pg_catalog, pg_temp",
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_SAVE, true);
+
+	initStringInfo(&sql);
+
+	if (TARGET_SET(pgcd_history_table))
+		become_table_owner(pgcd_history_table, &save_userid,
+						   &save_sec_context);
+
+	for (i = 0; i < count && TARGET_SET(pgcd_history_table); i++)
+	{
+		if (i % pgcd_history_batch == 0)
+		{
+			if (i > 0)
+			{
+				if (SPI_execute(sql.data, false, 0) != SPI_OK_INSERT)
+					elog(ERROR, "could not insert into \"%s\"",
+						 pgcd_history_table);
+				resetStringInfo(&sql);
+			}
+			appendStringInfo(&sql,
+							 "INSERT INTO %s (observed, state, control_time, "
+							 "checkpoint_pos, prior_checkpoint_pos, redo_pos, "
+							 "timeline, next_xid, next_oid, next_multixact, "
+							 "next_multi_offset, oldest_xid, oldest_xid_dbid, "
+							 "oldest_active_xid, checkpoint_time, "
+							 "min_recovery_pos, backup_start_pos) VALUES ",
+							 pgcd_history_table);
+		}
+		else
+			appendStringInfoChar(&sql, ',');
+
+		append_snapshot_sql(&sql, &snaps[i]);
+	}
+
+	if (i > 0 && SPI_execute(sql.data, false, 0) != SPI_OK_INSERT)
+		elog(ERROR, "could not insert into \"%s\"", pgcd_history_table);
+
+	/*
+	 * Compute the cutoff here rather than using now() - interval, so that
+	 * the planner sees a constant and constraint exclusion can skip
+	 * partitions that cannot contain expired rows.
+	 */
+	if (pgcd_history_retention > 0 && TARGET_SET(pgcd_history_table))
+	{
+		TimestampTz cutoff;
+
+		cutoff = GetCurrentTimestamp() -
+			(TimestampTz) pgcd_history_retention * 60 * USECS_PER_SEC;
+		resetStringInfo(&sql);
+		appendStringInfo(&sql, "DELETE FROM %s WHERE observed < '%s'",
+						 pgcd_history_table, timestamptz_literal(cutoff));
+		if (SPI_execute(sql.data, false, 0) != SPI_OK_DELETE)
+			elog(ERROR, "could not delete from \"%s\"", pgcd_history_table);
+	}
+
+	if (TARGET_SET(pgcd_history_table))
+		SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	if (TARGET_SET(pgcd_checkpoint_table))
+	{
+		become_table_owner(pgcd_checkpoint_table, &save_userid,
+						   &save_sec_context);
+		flush_checkpoints(snaps, count);
+		SetUserIdAndSecContext(save_userid, save_sec_context);
+	}
+
+	AtEOXact_GUC(false, save_nestlevel);
+
+	SPI_finish();
+
+	in_flush = false;
+	pfree(sql.data);
+	pfree(snaps);
+
+	return count;
+}
+
+/*
+ * Forget about an in-flight flush of ours, keeping its rows if committed.
+ */
+static void
+pgcd_flush_release(bool committed)
+{
+	in_flush = false;
+
+	if (!flush_in_flight)
+		return;
+	flush_in_flight = false;
+
+	LWLockAcquire(pgcd->lock, LW_EXCLUSIVE);
+	if (pgcd->flush_pid == MyProcPid)
+	{
+		if (committed)
+			pgcd->nflushed = pgcd->flush_upto;
+		pgcd->flush_pid = 0;
+	}
+	LWLockRelease(pgcd->lock);
+}
+
+static void
+pgcd_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+			pgcd_flush_release(true);
+			break;
+
+			/*
+			 * The rows now belong to the prepared transaction.  Flushing them
+			 * again would duplicate them after COMMIT PREPARED; after
+			 * ROLLBACK PREPARED they are lost, which is the lesser evil.
+			 */
+		case XACT_EVENT_PREPARE:
+			pgcd_flush_release(true);
+			break;
+		case XACT_EVENT_ABORT:
+			pgcd_flush_release(false);
+			break;
+	}
+}
+
+/*
+ * The rows of a flush made in a subtransaction are gone if that aborts,
+ * e.g. on ROLLBACK TO SAVEPOINT, and belong to its parent once it commits.
+ */
+static void
+pgcd_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+					  SubTransactionId parentSubid, void *arg)
+{
+	if (!flush_in_flight || mySubid != flush_subid)
+		return;
+
+	if (event == SUBXACT_EVENT_COMMIT_SUB)
+		flush_subid = parentSubid;
+	else if (event == SUBXACT_EVENT_ABORT_SUB)
+		pgcd_flush_release(false);
+}
+
+/*
+ * Flush from the sampler once a full batch is pending.
+ *
+ * This runs on behalf of somebody else's query, so it must neither write
+ * where writing is not allowed nor let a broken history table abort the
+ * caller; the INSERT is run in a subtransaction and failures are demoted to
+ * a WARNING.
+ */
+static void
+pgcd_maybe_flush(void)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	ResourceOwner oldowner = CurrentResourceOwner;
+	uint64		pending;
+
+	if (!TARGET_SET(pgcd_history_table) && !TARGET_SET(pgcd_checkpoint_table))
+		return;
+	if (XactReadOnly || RecoveryInProgress())
+		return;
+
+	LWLockAcquire(pgcd->lock, LW_SHARED);
+	pending = pgcd->nsnapshots - pgcd->nflushed;
+	if (pgcd->flush_pid != 0)
+		pending = 0;
+	LWLockRelease(pgcd->lock);
+
+	if (pending < (uint64) pgcd_history_batch)
+		return;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		pgcd_history_flush_internal();
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		pgcd_flush_release(false);
+
+		ereport(WARNING,
+				(errmsg("could not flush control file history: %s",
+						edata->message)));
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+}
+
+/*
+ * ExecutorEnd hook: give the sampler a chance to run.
+ */
+static void
+pgcd_ExecutorEnd(QueryDesc *queryDesc)
+{
+	if (prev_ExecutorEnd)
+		prev_ExecutorEnd(queryDesc);
+	else
+		standard_ExecutorEnd(queryDesc);
+
+	pgcd_maybe_sample();
+	pgcd_walrate_maybe_sample();
+}
+
+/*
+ * Return the control file snapshots retained in shared memory.
+ */
+Datum
+pg_controldata_history(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	pgcdSnapshot	   *snaps;
+	int					count;
+	int					i;
+
+	if (!pgcd)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	count = pgcd_history_copy(&snaps);
+	for (i = 0; i < count; i++)
+	{
+		Datum		values[PGCD_SNAPSHOT_COLS];
+		bool		nulls[PGCD_SNAPSHOT_COLS];
+
+		pgcd_snapshot_values(&snaps[i], values, nulls);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Write pending snapshots to history_table now, regardless of batch size.
+ */
+Datum
+pg_controldata_history_flush(PG_FUNCTION_ARGS)
+{
+	if (!pgcd)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	if (!TARGET_SET(pgcd_history_table) && !TARGET_SET(pgcd_checkpoint_table))
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("neither pg_controldata.history_table nor "
+						"pg_controldata.checkpoint_table is set")));
+
+	PG_RETURN_INT32(pgcd_history_flush_internal());
+}
@@ -0,0 +1,165 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_shutdown.c
+ *		Predict how long a clean shutdown will take.
+ *
+ * A clean shutdown ends with a checkpoint that must write out every dirty
+ * shared buffer, unthrottled.  We estimate the dirty volume by counting
+ * dirty buffer headers, and the write rate from the checkpoints in the
+ * snapshot history: their durations (checkpoint start to control file
+ * update) and the average number of buffers each one wrote according to
+ * the bgwriter statistics.
+ *
+ * Ordinary checkpoints are spread out by checkpoint_completion_target, so
+ * the observed rate is a floor on what the storage can do and the
+ * prediction errs on the long side.  Callers who know their device's
+ * sustained write rate can pass it in instead.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/htup.h"
+#include "funcapi.h"
+#include "pgstat.h"
+#include "storage/buf_internals.h"
+
+#include "pg_controldata.h"
+
+
+/* how many of the most recent checkpoints to average over */
+#define RECENT_CHECKPOINTS	16
+
+Datum		pg_controldata_shutdown_estimate(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_shutdown_estimate);
+
+
+/*
+ * Average duration in seconds of the most recent checkpoints, or -1 if
+ * none could be measured.  *count is set to the number used.
+ */
+static double
+recent_checkpoint_seconds(int *count)
+{
+	pgcdSnapshot *snaps;
+	int			n;
+	int			i;
+	int			used = 0;
+	double		total = 0;
+
+	n = pgcd_history_checkpoints(&snaps);
+
+	for (i = n - 1; i >= 0 && used < RECENT_CHECKPOINTS; i--)
+	{
+		pg_time_t	start = snaps[i].control.checkPointCopy.time;
+		pg_time_t	end = snaps[i].control.time;
+
+		if (end < start)
+			continue;
+		total += (double) (end - start);
+		used++;
+	}
+
+	pfree(snaps);
+
+	*count = used;
+	return (used > 0) ? total / used : -1;
+}
+
+/*
+ * Estimate the duration of a clean shutdown right now.
+ *
+ * The dirty buffer count is taken without locking the buffer headers, so
+ * it is only a snapshot of a moving target; that is plenty for an
+ * estimate and keeps this from interfering with running queries.
+ */
+Datum
+pg_controldata_shutdown_estimate(PG_FUNCTION_ARGS)
+{
+	double		max_seconds = PG_ARGISNULL(0) ? 60.0 : PG_GETARG_FLOAT8(0);
+	TupleDesc	tupdesc;
+	Datum		values[7];
+	bool		nulls[7];
+	int64		dirty = 0;
+	int			nckpt;
+	double		avg_seconds;
+	double		rate = -1;
+	int			i;
+
+	if (!pgcd)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	for (i = 0; i < NBuffers; i++)
+	{
+		volatile BufferDesc *buf = &BufferDescriptors[i];
+
+		if (buf->flags & BM_DIRTY)
+			dirty++;
+	}
+
+	avg_seconds = recent_checkpoint_seconds(&nckpt);
+
+	if (!PG_ARGISNULL(1))
+		rate = PG_GETARG_FLOAT8(1);
+	else if (avg_seconds > 0)
+	{
+		PgStat_GlobalStats *stats = pgstat_fetch_global();
+		int64		nstat = stats->timed_checkpoints +
+			stats->requested_checkpoints;
+
+		if (nstat > 0)
+			rate = ((double) stats->buf_written_checkpoints / nstat) *
+				BLCKSZ / avg_seconds;
+	}
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = Int64GetDatum(dirty);
+	values[1] = Int64GetDatum(dirty * BLCKSZ);
+	values[2] = Int32GetDatum(nckpt);
+	if (avg_seconds >= 0)
+		values[3] = Float8GetDatum(avg_seconds);
+	else
+		nulls[3] = true;
+
+	if (rate > 0)
+	{
+		double		estimate = (double) dirty * BLCKSZ / rate;
+
+		values[4] = Float8GetDatum(rate);
+		values[5] = Float8GetDatum(estimate);
+		values[6] = BoolGetDatum(estimate > max_seconds);
+	}
+	else
+		nulls[4] = nulls[5] = nulls[6] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
@@ -0,0 +1,457 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_startup.c
+ *		Record how long each server start spent in recovery.
+ *
+ * Shared memory is set up afresh by the postmaster before every start of
+ * the startup process, including the reinitialization after a backend
+ * crash, so that is where we look at pg_control as the startup process is
+ * going to find it: its state tells whether crash recovery is needed, and
+ * the latest checkpoint's redo location (or the backup_label's start
+ * location) is where replay begins.  Nobody can run queries during crash
+ * recovery, so the end is recognized later, on the first image in
+ * production that the sampler or pg_controldata() comes across.  After
+ * recovery the startup process writes an end-of-recovery checkpoint and
+ * then marks the cluster in production, so that image's time is when
+ * recovery finished and its checkpoint location is where replay ended.
+ *
+ * Completed records are appended to a file under global/, which, unlike
+ * shared memory or the history table, survives a crash in the middle of
+ * the next recovery and is available on a standby.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+
+#include "pg_controldata.h"
+
+
+/* location of the record file, relative to the data directory */
+#define STARTUP_FILE		"global/pg_controldata_startup.stat"
+
+/* magic number identifying the record file format */
+#define STARTUP_FILE_HEADER	0x50435331
+
+/* files looked at by the startup process, see xlog.c */
+#define RECOVERY_COMMAND_FILE	"recovery.conf"
+#define BACKUP_LABEL_FILE		"backup_label"
+
+typedef enum pgcdRecoveryKind
+{
+	PGCD_RECOVERY_NONE,			/* clean start */
+	PGCD_RECOVERY_CRASH,
+	PGCD_RECOVERY_ARCHIVE
+} pgcdRecoveryKind;
+
+/*
+ * One server start, as stored in the record file.
+ */
+typedef struct pgcdStartupRecord
+{
+	TimestampTz		started;		/* shared memory initialization */
+	TimestampTz		ended;			/* cluster marked in production */
+	int32			kind;			/* a pgcdRecoveryKind */
+	int32			start_state;	/* DBState found at start */
+	int64			redo_pos;		/* where replay started */
+	int64			end_pos;		/* where replay ended */
+	bool			exact;			/* end image was the end of recovery */
+} pgcdStartupRecord;
+
+typedef struct pgcdStartupState
+{
+	slock_t			mutex;			/* protects pending */
+	bool			pending;		/* waiting for the production image */
+	pgcdStartupRecord rec;
+	ControlFileData	before;			/* pg_control as found at start */
+} pgcdStartupState;
+
+static pgcdStartupState *startup = NULL;
+
+static const char *kind_name(int kind);
+static int64 backup_label_pos(void);
+static void append_record(const pgcdStartupRecord *rec);
+static void put_record(Tuplestorestate *tupstore, TupleDesc tupdesc,
+					   const pgcdStartupRecord *rec);
+
+Datum		pg_controldata_startups(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_startups);
+
+
+/*
+ * Estimate shared memory space needed.
+ */
+Size
+pgcd_startup_shmem_size(void)
+{
+	return MAXALIGN(sizeof(pgcdStartupState));
+}
+
+/*
+ * Allocate shared memory and note how this start begins; caller holds
+ * AddinShmemInitLock.
+ */
+void
+pgcd_startup_shmem_startup(void)
+{
+	bool		found;
+	pgcdStartupRecord *rec;
+	struct stat st;
+
+	startup = ShmemInitStruct("pg_controldata startup",
+							  pgcd_startup_shmem_size(),
+							  &found);
+
+	if (found)
+		return;
+
+	SpinLockInit(&startup->mutex);
+	startup->pending = false;
+	rec = &startup->rec;
+	memset(rec, 0, sizeof(pgcdStartupRecord));
+
+	if (!pgcd_read_controlfile(DataDir, &startup->before, LOG))
+		return;
+
+	rec->started = GetCurrentTimestamp();
+	rec->start_state = (int32) startup->before.state;
+	rec->redo_pos = PGCD_LSN_POS(startup->before.checkPointCopy.redo);
+
+	if (stat(RECOVERY_COMMAND_FILE, &st) == 0 ||
+		stat(BACKUP_LABEL_FILE, &st) == 0)
+	{
+		int64		label_pos = backup_label_pos();
+
+		rec->kind = PGCD_RECOVERY_ARCHIVE;
+		if (label_pos >= 0)
+			rec->redo_pos = label_pos;
+	}
+	else if (startup->before.state != DB_SHUTDOWNED)
+		rec->kind = PGCD_RECOVERY_CRASH;
+	else
+		rec->kind = PGCD_RECOVERY_NONE;
+
+	if (rec->kind != PGCD_RECOVERY_NONE)
+	{
+		XLogRecPtr	redo;
+
+		redo.xlogid = (uint32) (rec->redo_pos / XLogFileSize);
+		redo.xrecoff = (uint32) (rec->redo_pos % XLogFileSize);
+		pgcd_readahead_wal(startup->before.checkPointCopy.ThisTimeLineID,
+						   redo);
+	}
+
+	startup->pending = true;
+}
+
+/*
+ * Complete the pending record if cf is the first image in production since
+ * this start.  Cheap once that has happened.
+ */
+void
+pgcd_startup_observe(const ControlFileData *cf)
+{
+	volatile pgcdStartupState *s = startup;
+	pgcdStartupRecord rec;
+	bool		complete = false;
+
+	if (!s || !s->pending || cf->state != DB_IN_PRODUCTION)
+		return;
+
+	/* an unchanged image would be from before we started */
+	if (memcmp(cf, &startup->before, sizeof(ControlFileData)) == 0)
+		return;
+
+	SpinLockAcquire(&s->mutex);
+	if (s->pending)
+	{
+		s->rec.ended = time_t_to_timestamptz(cf->time);
+		s->rec.end_pos = PGCD_LSN_POS(cf->checkPoint);
+
+		/*
+		 * An end-of-recovery checkpoint is written like a shutdown
+		 * checkpoint, with redo equal to its own location; after a clean
+		 * start nothing is written at all.  Otherwise we came too late and
+		 * regular checkpoints have happened since, so the end is later than
+		 * the truth.
+		 */
+		if (s->rec.kind == PGCD_RECOVERY_NONE)
+			s->rec.exact = XLByteEQ(cf->checkPoint,
+									startup->before.checkPoint);
+		else
+			s->rec.exact = XLByteEQ(cf->checkPoint, cf->checkPointCopy.redo);
+
+		memcpy(&rec, (pgcdStartupRecord *) &s->rec, sizeof(pgcdStartupRecord));
+		s->pending = false;
+		complete = true;
+	}
+	SpinLockRelease(&s->mutex);
+
+	if (complete)
+		append_record(&rec);
+}
+
+static const char *
+kind_name(int kind)
+{
+	switch (kind)
+	{
+		case PGCD_RECOVERY_NONE:
+			return "none";
+		case PGCD_RECOVERY_CRASH:
+			return "crash";
+		case PGCD_RECOVERY_ARCHIVE:
+			return "archive";
+	}
+	return "unknown";
+}
+
+/*
+ * Replay of a base backup starts at the backup's start location rather
+ * than at the checkpoint in pg_control.  Returns -1 if there is no usable
+ * backup_label.
+ */
+static int64
+backup_label_pos(void)
+{
+	FILE	   *fp;
+	XLogRecPtr	ptr;
+	int64		result = -1;
+
+	fp = AllocateFile(BACKUP_LABEL_FILE, "r");
+	if (!fp)
+		return -1;
+
+	if (fscanf(fp, "START WAL LOCATION: %X/%X",
+			   &ptr.xlogid, &ptr.xrecoff) == 2)
+		result = PGCD_LSN_POS(ptr);
+
+	FreeFile(fp);
+
+	return result;
+}
+
+/*
+ * Append one record to the record file, writing the header first if the
+ * file is new.  Header and record go out in a single write, and a torn
+ * record left by an earlier failed write is cut off first, so that the
+ * file always holds whole records after the header.  Failure only costs us
+ * the record, so it is merely logged.
+ */
+static void
+append_record(const pgcdStartupRecord *rec)
+{
+	int			fd;
+	struct stat st;
+	uint32		header = STARTUP_FILE_HEADER;
+	char		buf[sizeof(uint32) + sizeof(pgcdStartupRecord)];
+	off_t		whole;
+	size_t		len = 0;
+
+	fd = BasicOpenFile(STARTUP_FILE, O_WRONLY | O_CREAT | O_APPEND | PG_BINARY,
+					   S_IRUSR | S_IWUSR);
+	if (fd < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", STARTUP_FILE)));
+		return;
+	}
+
+	if (fstat(fd, &st) < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file \"%s\": %m", STARTUP_FILE)));
+		close(fd);
+		return;
+	}
+
+	if (st.st_size < (off_t) sizeof(header))
+		whole = 0;
+	else
+		whole = st.st_size - (st.st_size - sizeof(header)) %
+			sizeof(pgcdStartupRecord);
+
+	if (whole != st.st_size && ftruncate(fd, whole) < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not truncate file \"%s\": %m", STARTUP_FILE)));
+		close(fd);
+		return;
+	}
+
+	if (whole == 0)
+	{
+		memcpy(buf, &header, sizeof(header));
+		len = sizeof(header);
+	}
+	memcpy(buf + len, rec, sizeof(pgcdStartupRecord));
+	len += sizeof(pgcdStartupRecord);
+
+	if (write(fd, buf, len) != len)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", STARTUP_FILE)));
+		/* don't leave a partial record behind, if we can help it */
+		if (ftruncate(fd, whole) < 0)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not truncate file \"%s\": %m",
+							STARTUP_FILE)));
+	}
+
+	close(fd);
+}
+
+static void
+put_record(Tuplestorestate *tupstore, TupleDesc tupdesc,
+		   const pgcdStartupRecord *rec)
+{
+	Datum		values[10];
+	bool		nulls[10];
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = TimestampTzGetDatum(rec->started);
+	values[1] = CStringGetTextDatum(kind_name(rec->kind));
+	values[2] = CStringGetTextDatum(pgcd_dbstate((DBState) rec->start_state));
+	values[3] = Int64GetDatum(rec->redo_pos);
+
+	if (rec->ended != 0)
+	{
+		double		seconds = (double) (rec->ended - rec->started);
+		int64		replayed = Max(rec->end_pos - rec->redo_pos, 0);
+
+#ifdef HAVE_INT64_TIMESTAMP
+		seconds /= USECS_PER_SEC;
+#endif
+
+		values[4] = TimestampTzGetDatum(rec->ended);
+		values[5] = Float8GetDatum(seconds);
+		values[6] = Int64GetDatum(rec->end_pos);
+		values[7] = Int64GetDatum(replayed);
+		if (seconds > 0)
+			values[8] = Float8GetDatum(replayed / (1024.0 * 1024.0) / seconds);
+		else
+			nulls[8] = true;
+		values[9] = BoolGetDatum(rec->exact);
+	}
+	else
+		nulls[4] = nulls[5] = nulls[6] = nulls[7] = nulls[8] = nulls[9] = true;
+
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
+
+/*
+ * List the recorded server starts, oldest first, followed by the current
+ * one if it has not reached production yet.
+ */
+Datum
+pg_controldata_startups(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	FILE			   *fp;
+	pgcdStartupRecord	rec;
+	bool				pending = false;
+
+	if (!startup)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	fp = AllocateFile(STARTUP_FILE, PG_BINARY_R);
+	if (fp)
+	{
+		uint32		header;
+
+		if (fread(&header, sizeof(header), 1, fp) == 1 &&
+			header == STARTUP_FILE_HEADER)
+		{
+			/* records are whole, see append_record(); a torn tail is skipped */
+			while (fread(&rec, sizeof(rec), 1, fp) == 1)
+				put_record(tupstore, tupdesc, &rec);
+		}
+		else
+			ereport(WARNING,
+					(errmsg("ignoring invalid file \"%s\"", STARTUP_FILE)));
+		FreeFile(fp);
+	}
+	else if (errno != ENOENT)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", STARTUP_FILE)));
+
+	SpinLockAcquire(&startup->mutex);
+	if (startup->pending)
+	{
+		memcpy(&rec, &startup->rec, sizeof(pgcdStartupRecord));
+		pending = true;
+	}
+	SpinLockRelease(&startup->mutex);
+
+	if (pending)
+		put_record(tupstore, tupdesc, &rec);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,446 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_walrate.c
+ *		Sample the live WAL insert and write positions.
+ *
+ * The redo location in pg_control moves once per checkpoint, which only
+ * shows the average WAL rate over a whole checkpoint interval.  Like the
+ * control file sampler, this one runs at the end of query execution, at
+ * most once per pg_controldata.wal_sample_interval across all backends,
+ * and costs a spinlock-protected timestamp comparison when not due.  The
+ * positions go into a ring of pg_controldata.wal_samples entries.
+ *
+ * pg_controldata_wal_rate() assigns the rate between each pair of
+ * consecutive samples to the checkpoint interval its WAL belongs to, by
+ * redo location, and summarizes each interval with percentiles, so that
+ * short bursts stand out against the average.  Gaps without any query
+ * activity are averaged over, of course.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/xlog.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+
+#include "pg_controldata.h"
+
+
+typedef struct pgcdWalSample
+{
+	TimestampTz		time;
+	int64			insert_pos;
+	int64			write_pos;
+} pgcdWalSample;
+
+/*
+ * Sample number n lives in ring[n % ring_size], like the snapshot ring.
+ */
+typedef struct pgcdWalRateState
+{
+	LWLockId		lock;			/* protects the ring */
+	slock_t			mutex;			/* protects last_sample */
+	TimestampTz		last_sample;
+	uint64			nsamples;
+	int				ring_size;
+	pgcdWalSample	ring[1];		/* VARIABLE LENGTH ARRAY */
+} pgcdWalRateState;
+
+/* GUC variables */
+int			pgcd_wal_samples;
+int			pgcd_wal_sample_interval;
+
+static pgcdWalRateState *walrate = NULL;
+
+static int	walrate_copy(pgcdWalSample **result);
+static int	double_cmp(const void *a, const void *b);
+static double percentile(const double *sorted, int n, double fraction);
+static double seconds_between(TimestampTz a, TimestampTz b);
+
+Datum		pg_controldata_wal_samples(PG_FUNCTION_ARGS);
+Datum		pg_controldata_wal_rate(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_wal_samples);
+PG_FUNCTION_INFO_V1(pg_controldata_wal_rate);
+
+
+/*
+ * Define GUCs; called from _PG_init.
+ */
+void
+pgcd_walrate_init(void)
+{
+	DefineCustomIntVariable("pg_controldata.wal_samples",
+		"Sets the number of WAL position samples kept in shared memory.",
+							NULL,
+							&pgcd_wal_samples,
+							3600,
+							16,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_controldata.wal_sample_interval",
+		"Sets the minimum time between two samples of the WAL positions.",
+							"Zero disables WAL position sampling.",
+							&pgcd_wal_sample_interval,
+							1000,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MS,
+							NULL,
+							NULL);
+}
+
+/*
+ * Estimate shared memory space needed.
+ */
+Size
+pgcd_walrate_shmem_size(void)
+{
+	Size		size;
+
+	size = offsetof(pgcdWalRateState, ring);
+	size = add_size(size, mul_size(pgcd_wal_samples, sizeof(pgcdWalSample)));
+
+	return size;
+}
+
+/*
+ * Allocate or attach to shared memory; caller holds AddinShmemInitLock.
+ */
+void
+pgcd_walrate_shmem_startup(void)
+{
+	bool		found;
+
+	walrate = ShmemInitStruct("pg_controldata wal rate",
+							  pgcd_walrate_shmem_size(),
+							  &found);
+
+	if (!found)
+	{
+		walrate->lock = LWLockAssign();
+		SpinLockInit(&walrate->mutex);
+		walrate->last_sample = 0;
+		walrate->nsamples = 0;
+		walrate->ring_size = pgcd_wal_samples;
+	}
+}
+
+/*
+ * Record the WAL positions if nobody has done so for wal_sample_interval.
+ * There is no WAL being generated during recovery.
+ */
+void
+pgcd_walrate_maybe_sample(void)
+{
+	volatile pgcdWalRateState *s = walrate;
+	pgcdWalSample sample;
+	XLogRecPtr	insert;
+	XLogRecPtr	write;
+	bool		due;
+
+	if (!walrate || pgcd_wal_sample_interval <= 0)
+		return;
+
+	sample.time = GetCurrentTimestamp();
+
+	SpinLockAcquire(&s->mutex);
+	due = TimestampDifferenceExceeds(s->last_sample, sample.time,
+									 pgcd_wal_sample_interval);
+	if (due)
+		s->last_sample = sample.time;
+	SpinLockRelease(&s->mutex);
+
+	if (!due || RecoveryInProgress())
+		return;
+
+	insert = GetInsertRecPtr();
+	write = GetWriteRecPtr();
+	sample.insert_pos = PGCD_LSN_POS(insert);
+	sample.write_pos = PGCD_LSN_POS(write);
+
+	LWLockAcquire(walrate->lock, LW_EXCLUSIVE);
+	walrate->ring[walrate->nsamples % walrate->ring_size] = sample;
+	walrate->nsamples++;
+	LWLockRelease(walrate->lock);
+}
+
+/*
+ * Copy the retained samples, oldest first, into palloc'd memory.
+ */
+static int
+walrate_copy(pgcdWalSample **result)
+{
+	uint64		start;
+	uint64		n;
+	int			count = 0;
+
+	LWLockAcquire(walrate->lock, LW_SHARED);
+
+	start = (walrate->nsamples > (uint64) walrate->ring_size) ?
+		walrate->nsamples - walrate->ring_size : 0;
+
+	*result = (pgcdWalSample *)
+		palloc(Max(walrate->nsamples - start, 1) * sizeof(pgcdWalSample));
+	for (n = start; n < walrate->nsamples; n++)
+		(*result)[count++] = walrate->ring[n % walrate->ring_size];
+
+	LWLockRelease(walrate->lock);
+
+	return count;
+}
+
+static int
+double_cmp(const void *a, const void *b)
+{
+	double		da = *(const double *) a;
+	double		db = *(const double *) b;
+
+	if (da < db)
+		return -1;
+	if (da > db)
+		return 1;
+	return 0;
+}
+
+/* nearest-rank percentile of a sorted array */
+static double
+percentile(const double *sorted, int n, double fraction)
+{
+	int			rank = (int) ceil(fraction * n);
+
+	return sorted[Max(rank, 1) - 1];
+}
+
+/* seconds between two timestamps */
+static double
+seconds_between(TimestampTz a, TimestampTz b)
+{
+	double		diff = (double) (b - a);
+
+#ifdef HAVE_INT64_TIMESTAMP
+	diff /= USECS_PER_SEC;
+#endif
+	return diff;
+}
+
+/*
+ * Return the WAL position samples, oldest first.
+ */
+Datum
+pg_controldata_wal_samples(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	pgcdWalSample	   *samples;
+	int					count;
+	int					i;
+
+	if (!walrate)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	count = walrate_copy(&samples);
+	for (i = 0; i < count; i++)
+	{
+		Datum		values[4];
+		bool		nulls[4];
+		double		secs;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = TimestampTzGetDatum(samples[i].time);
+		values[1] = Int64GetDatum(samples[i].insert_pos);
+		values[2] = Int64GetDatum(samples[i].write_pos);
+
+		/* rate since the previous sample */
+		if (i > 0 &&
+			(secs = seconds_between(samples[i - 1].time, samples[i].time)) > 0)
+			values[3] = Float8GetDatum((samples[i].insert_pos -
+										samples[i - 1].insert_pos) / secs);
+		else
+			nulls[3] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Summarize the WAL rate per checkpoint interval.  Interval i runs from
+ * the redo location of checkpoint i in the snapshot history to that of the
+ * next one; the last interval is still open.  Each pair of consecutive
+ * samples belongs to the interval holding the later sample's insert
+ * position.
+ */
+Datum
+pg_controldata_wal_rate(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	pgcdSnapshot	   *ckpts;
+	pgcdWalSample	   *samples;
+	double			   *rates;
+	int					nckpts;
+	int					nsamples;
+	int					c;
+	int					s = 1;
+
+	if (!walrate || !pgcd)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	nckpts = pgcd_history_checkpoints(&ckpts);
+	nsamples = walrate_copy(&samples);
+	rates = (double *) palloc(Max(nsamples, 1) * sizeof(double));
+
+	for (c = 0; c < nckpts; c++)
+	{
+		const ControlFileData *cf = &ckpts[c].control;
+		int64		lo = PGCD_LSN_POS(cf->checkPointCopy.redo);
+		int64		hi = (c + 1 < nckpts) ?
+			PGCD_LSN_POS(ckpts[c + 1].control.checkPointCopy.redo) : -1;
+		int64		wal_bytes = 0;
+		int64		max_lag = 0;
+		double		secs = 0;
+		int			n = 0;
+		Datum		values[11];
+		bool		nulls[11];
+
+		/* skip samples before this interval */
+		while (s < nsamples && samples[s].insert_pos < lo)
+			s++;
+
+		for (; s < nsamples && (hi < 0 || samples[s].insert_pos < hi); s++)
+		{
+			const pgcdWalSample *prev = &samples[s - 1];
+			const pgcdWalSample *cur = &samples[s];
+			double		dt = seconds_between(prev->time, cur->time);
+
+			max_lag = Max(max_lag, cur->insert_pos - cur->write_pos);
+			if (dt <= 0)
+				continue;
+			rates[n++] = (cur->insert_pos - prev->insert_pos) / dt;
+			wal_bytes += cur->insert_pos - prev->insert_pos;
+			secs += dt;
+		}
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int64GetDatum(PGCD_LSN_POS(cf->checkPoint));
+		values[1] = Int64GetDatum(lo);
+		values[2] = TimestampTzGetDatum(time_t_to_timestamptz(cf->checkPointCopy.time));
+		values[3] = Int32GetDatum(n);
+
+		if (n > 0)
+		{
+			qsort(rates, n, sizeof(double), double_cmp);
+
+			values[4] = Int64GetDatum(wal_bytes);
+			values[5] = Float8GetDatum(wal_bytes / secs);
+			values[6] = Float8GetDatum(percentile(rates, n, 0.50));
+			values[7] = Float8GetDatum(percentile(rates, n, 0.90));
+			values[8] = Float8GetDatum(percentile(rates, n, 0.99));
+			values[9] = Float8GetDatum(rates[n - 1]);
+			values[10] = Int64GetDatum(max_lag);
+		}
+		else
+			nulls[4] = nulls[5] = nulls[6] = nulls[7] = nulls[8] =
+				nulls[9] = nulls[10] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	pfree(ckpts);
+	pfree(samples);
+	pfree(rates);
+
+	return (Datum) 0;
+}
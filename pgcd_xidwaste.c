@@ -0,0 +1,526 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_xidwaste.c
+ *		Compare XID consumption with the transactions that committed or
+ *		rolled back between checkpoints.
+ *
+ * Every subtransaction that writes gets an XID of its own, and so does
+ * every attempt of a retried bulk load, while pg_stat_database counts only
+ * the top-level transactions.  A cluster consuming many more XIDs than it
+ * runs transactions approaches wraparound faster than its transaction rate
+ * suggests.  Read-only transactions take no XID, so the ratio is normally
+ * below one; it is the excess above one that is worth a look.
+ *
+ * When the sampler first sees a new checkpoint, we record the current
+ * next XID with the xact_commit + xact_rollback and tuples written of every
+ * database, all read at the same moment, keeping the last
+ * pg_controldata.xact_checkpoints of them.  The checkpoint only triggers
+ * and labels the collection: its own NextXID dates from when it started,
+ * which on a quiet cluster can be long before the sampler notices it.  The
+ * pg_database scan runs in a subtransaction on behalf of whatever query
+ * happened to end, so a failure is only a WARNING.  XIDs are not
+ * attributed to databases, so to tell which database dominates we report
+ * each one's share of the tuples written, which is what consumes XIDs.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres.h"
+
+#include "access/heapam.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/pg_database.h"
+#include "commands/dbcommands.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/resowner.h"
+#include "utils/tqual.h"
+
+#include "pg_controldata.h"
+
+
+/*
+ * Counters of one database at one checkpoint.  Databases beyond
+ * xact_databases are summed up under InvalidOid.
+ */
+typedef struct pgcdDbCounts
+{
+	Oid				dbid;
+	int64			xacts;			/* xact_commit + xact_rollback */
+	int64			writes;			/* tuples inserted, updated, deleted */
+} pgcdDbCounts;
+
+typedef struct pgcdXactCheckpoint
+{
+	int64			checkpoint_pos;
+	TimestampTz		collected;		/* when next_xid and counters were read */
+	int64			next_xid;		/* with epoch */
+	int				ndbs;
+} pgcdXactCheckpoint;
+
+/*
+ * Checkpoint number n lives in ring[n % ring_size], its database counters
+ * in dbs[(n % ring_size) * max_dbs ...].
+ */
+typedef struct pgcdXactState
+{
+	LWLockId		lock;
+	uint64			ncheckpoints;
+	int				ring_size;
+	int				max_dbs;
+	pgcdXactCheckpoint *ring;
+	pgcdDbCounts   *dbs;
+} pgcdXactState;
+
+/* GUC variables */
+int			pgcd_xact_checkpoints;
+int			pgcd_xact_databases;
+
+static pgcdXactState *xacts = NULL;
+
+static int	collect_counts(pgcdDbCounts *dbs, int max_dbs);
+static const pgcdDbCounts *find_db(const pgcdDbCounts *dbs, int ndbs, Oid dbid);
+static int64 counter_delta(int64 prev, int64 cur);
+
+Datum		pg_controldata_xid_waste(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_controldata_xid_waste);
+
+
+/*
+ * Define GUCs; called from _PG_init.
+ */
+void
+pgcd_xidwaste_init(void)
+{
+	DefineCustomIntVariable("pg_controldata.xact_checkpoints",
+		"Sets the number of checkpoints whose transaction counts are kept.",
+							"Zero disables recording them.",
+							&pgcd_xact_checkpoints,
+							64,
+							0,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_controldata.xact_databases",
+		"Sets the number of databases tracked individually per checkpoint.",
+							NULL,
+							&pgcd_xact_databases,
+							64,
+							1,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL);
+}
+
+/*
+ * Estimate shared memory space needed.
+ */
+Size
+pgcd_xidwaste_shmem_size(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(pgcdXactState));
+	size = add_size(size, MAXALIGN(mul_size(pgcd_xact_checkpoints,
+											sizeof(pgcdXactCheckpoint))));
+	size = add_size(size, mul_size(mul_size(pgcd_xact_checkpoints,
+											pgcd_xact_databases + 1),
+								   sizeof(pgcdDbCounts)));
+
+	return size;
+}
+
+/*
+ * Allocate or attach to shared memory; caller holds AddinShmemInitLock.
+ */
+void
+pgcd_xidwaste_shmem_startup(void)
+{
+	bool		found;
+
+	xacts = ShmemInitStruct("pg_controldata xid waste",
+							pgcd_xidwaste_shmem_size(),
+							&found);
+
+	if (!found)
+	{
+		char	   *p = (char *) xacts + MAXALIGN(sizeof(pgcdXactState));
+
+		xacts->lock = LWLockAssign();
+		xacts->ncheckpoints = 0;
+		xacts->ring_size = pgcd_xact_checkpoints;
+		/* one more slot for the others */
+		xacts->max_dbs = pgcd_xact_databases + 1;
+		xacts->ring = (pgcdXactCheckpoint *) p;
+		p += MAXALIGN(xacts->ring_size * sizeof(pgcdXactCheckpoint));
+		xacts->dbs = (pgcdDbCounts *) p;
+	}
+}
+
+/*
+ * Read the statistics counters of every database into dbs.  Returns the
+ * number of entries used, at most max_dbs.
+ */
+static int
+collect_counts(pgcdDbCounts *dbs, int max_dbs)
+{
+	Relation	rel;
+	HeapScanDesc scan;
+	HeapTuple	tup;
+	int			ndbs = 0;
+	pgcdDbCounts other;
+
+	other.dbid = InvalidOid;
+	other.xacts = other.writes = 0;
+
+	rel = heap_open(DatabaseRelationId, AccessShareLock);
+	scan = heap_beginscan(rel, SnapshotNow, 0, NULL);
+
+	while ((tup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		PgStat_StatDBEntry *entry;
+		pgcdDbCounts *dest;
+
+		entry = pgstat_fetch_stat_dbentry(HeapTupleGetOid(tup));
+		if (entry == NULL)
+			continue;
+
+		if (ndbs < max_dbs - 1)
+		{
+			dest = &dbs[ndbs++];
+			dest->dbid = HeapTupleGetOid(tup);
+			dest->xacts = dest->writes = 0;
+		}
+		else
+			dest = &other;
+
+		dest->xacts += entry->n_xact_commit + entry->n_xact_rollback;
+		dest->writes += entry->n_tuples_inserted + entry->n_tuples_updated +
+			entry->n_tuples_deleted;
+	}
+
+	heap_endscan(scan);
+	heap_close(rel, AccessShareLock);
+
+	if (other.xacts > 0 || other.writes > 0)
+		dbs[ndbs++] = other;
+
+	return ndbs;
+}
+
+/*
+ * Record the counters if cf holds a checkpoint we have not seen yet; called
+ * by the sampler inside a transaction.  Standbys assign no XIDs.
+ */
+void
+pgcd_xidwaste_observe(const ControlFileData *cf)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	ResourceOwner oldowner = CurrentResourceOwner;
+	int64		pos = PGCD_LSN_POS(cf->checkPoint);
+	pgcdDbCounts *dbs;
+	pgcdXactCheckpoint *entry;
+	TimestampTz collected;
+	TransactionId next_xid;
+	uint32		epoch;
+	bool		seen;
+	bool		ok = true;
+	int			ndbs = 0;
+	int			slot;
+
+	if (!xacts || xacts->ring_size <= 0 || RecoveryInProgress())
+		return;
+
+	LWLockAcquire(xacts->lock, LW_SHARED);
+	seen = xacts->ncheckpoints > 0 &&
+		xacts->ring[(xacts->ncheckpoints - 1) % xacts->ring_size].checkpoint_pos == pos;
+	LWLockRelease(xacts->lock);
+
+	if (seen)
+		return;
+
+	/*
+	 * The catalog scan can fail; do it before taking the lock, and in a
+	 * subtransaction, so as not to abort the query we piggy-back on.
+	 */
+	dbs = (pgcdDbCounts *) palloc(xacts->max_dbs * sizeof(pgcdDbCounts));
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		ndbs = collect_counts(dbs, xacts->max_dbs);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		ereport(WARNING,
+				(errmsg("could not collect transaction counts: %s",
+						edata->message)));
+		FreeErrorData(edata);
+		ok = false;
+	}
+	PG_END_TRY();
+
+	if (!ok)
+	{
+		pfree(dbs);
+		return;
+	}
+
+	/* the XIDs of the same moment as the counters */
+	GetNextXidAndEpoch(&next_xid, &epoch);
+	collected = GetCurrentTimestamp();
+
+	LWLockAcquire(xacts->lock, LW_EXCLUSIVE);
+
+	/* somebody may have beaten us to it */
+	if (xacts->ncheckpoints == 0 ||
+		xacts->ring[(xacts->ncheckpoints - 1) % xacts->ring_size].checkpoint_pos != pos)
+	{
+		slot = xacts->ncheckpoints % xacts->ring_size;
+		entry = &xacts->ring[slot];
+		entry->checkpoint_pos = pos;
+		entry->collected = collected;
+		entry->next_xid = PGCD_FULL_XID(epoch, next_xid);
+		entry->ndbs = ndbs;
+		memcpy(&xacts->dbs[slot * xacts->max_dbs], dbs,
+			   ndbs * sizeof(pgcdDbCounts));
+		xacts->ncheckpoints++;
+	}
+
+	LWLockRelease(xacts->lock);
+
+	pfree(dbs);
+}
+
+static const pgcdDbCounts *
+find_db(const pgcdDbCounts *dbs, int ndbs, Oid dbid)
+{
+	int			i;
+
+	for (i = 0; i < ndbs; i++)
+		if (dbs[i].dbid == dbid)
+			return &dbs[i];
+	return NULL;
+}
+
+/* increase of a statistics counter; after a reset, count from zero */
+static int64
+counter_delta(int64 prev, int64 cur)
+{
+	return (cur >= prev) ? cur - prev : cur;
+}
+
+/*
+ * One row per database for each interval between recorded checkpoints in
+ * which more than threshold XIDs were consumed per transaction (all
+ * intervals if threshold is NULL), databases by tuples written, descending.
+ */
+Datum
+pg_controldata_xid_waste(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate	   *tupstore;
+	TupleDesc			tupdesc;
+	MemoryContext		per_query_ctx;
+	MemoryContext		oldcontext;
+	pgcdXactCheckpoint *ckpts;
+	pgcdDbCounts	   *dbs;
+	int					max_dbs;
+	int					count = 0;
+	uint64				start;
+	uint64				n;
+	int					i;
+
+	if (!xacts)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_controldata must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* copy the ring, oldest first */
+	max_dbs = xacts->max_dbs;
+	LWLockAcquire(xacts->lock, LW_SHARED);
+	start = (xacts->ncheckpoints > (uint64) xacts->ring_size) ?
+		xacts->ncheckpoints - xacts->ring_size : 0;
+	ckpts = (pgcdXactCheckpoint *)
+		palloc(Max(xacts->ncheckpoints - start, 1) * sizeof(pgcdXactCheckpoint));
+	dbs = (pgcdDbCounts *)
+		palloc(Max(xacts->ncheckpoints - start, 1) * max_dbs * sizeof(pgcdDbCounts));
+	for (n = start; n < xacts->ncheckpoints; n++)
+	{
+		int			slot = n % xacts->ring_size;
+
+		ckpts[count] = xacts->ring[slot];
+		memcpy(&dbs[count * max_dbs], &xacts->dbs[slot * max_dbs],
+			   ckpts[count].ndbs * sizeof(pgcdDbCounts));
+		count++;
+	}
+	LWLockRelease(xacts->lock);
+
+	for (i = 1; i < count; i++)
+	{
+		const pgcdXactCheckpoint *prev = &ckpts[i - 1];
+		const pgcdXactCheckpoint *cur = &ckpts[i];
+		const pgcdDbCounts *prev_dbs = &dbs[(i - 1) * max_dbs];
+		const pgcdDbCounts *cur_dbs = &dbs[i * max_dbs];
+		int64	   *db_xacts;
+		int64	   *db_writes;
+		int		   *order;
+		int64		total_xacts = 0;
+		int64		total_writes = 0;
+		int64		xids = cur->next_xid - prev->next_xid;
+		double		ratio;
+		int			d;
+
+		db_xacts = (int64 *) palloc(Max(cur->ndbs, 1) * sizeof(int64));
+		db_writes = (int64 *) palloc(Max(cur->ndbs, 1) * sizeof(int64));
+		order = (int *) palloc(Max(cur->ndbs, 1) * sizeof(int));
+
+		for (d = 0; d < cur->ndbs; d++)
+		{
+			const pgcdDbCounts *p = find_db(prev_dbs, prev->ndbs,
+											cur_dbs[d].dbid);
+
+			db_xacts[d] = counter_delta(p ? p->xacts : 0, cur_dbs[d].xacts);
+			db_writes[d] = counter_delta(p ? p->writes : 0, cur_dbs[d].writes);
+			total_xacts += db_xacts[d];
+			total_writes += db_writes[d];
+			order[d] = d;
+		}
+
+		ratio = (total_xacts > 0) ? (double) xids / total_xacts : -1;
+
+		if (PG_ARGISNULL(0) ||
+			(ratio < 0 ? xids > 0 : ratio > PG_GETARG_FLOAT8(0)))
+		{
+			int			j;
+
+			/* insertion sort by tuples written, descending; there are few */
+			for (d = 1; d < cur->ndbs; d++)
+			{
+				int			o = order[d];
+
+				for (j = d; j > 0 && db_writes[order[j - 1]] < db_writes[o]; j--)
+					order[j] = order[j - 1];
+				order[j] = o;
+			}
+
+			for (j = 0; j < cur->ndbs; j++)
+			{
+				Datum		values[11];
+				bool		nulls[11];
+				char	   *datname = NULL;
+
+				d = order[j];
+				if (db_xacts[d] == 0 && db_writes[d] == 0)
+					continue;
+
+				memset(nulls, 0, sizeof(nulls));
+
+				values[0] = Int64GetDatum(cur->checkpoint_pos);
+				values[1] = TimestampTzGetDatum(prev->collected);
+				values[2] = TimestampTzGetDatum(cur->collected);
+				values[3] = Int64GetDatum(xids);
+				values[4] = Int64GetDatum(total_xacts);
+				if (ratio >= 0)
+					values[5] = Float8GetDatum(ratio);
+				else
+					nulls[5] = true;
+
+				if (OidIsValid(cur_dbs[d].dbid))
+					datname = get_database_name(cur_dbs[d].dbid);
+				if (datname)
+					values[6] = CStringGetTextDatum(datname);
+				else
+					nulls[6] = true;
+				values[7] = ObjectIdGetDatum(cur_dbs[d].dbid);
+				values[8] = Int64GetDatum(db_xacts[d]);
+				values[9] = Int64GetDatum(db_writes[d]);
+				if (total_writes > 0)
+					values[10] = Float8GetDatum((double) db_writes[d] / total_writes);
+				else
+					nulls[10] = true;
+
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+
+		pfree(db_xacts);
+		pfree(db_writes);
+		pfree(order);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	pfree(ckpts);
+	pfree(dbs);
+
+	return (Datum) 0;
+}
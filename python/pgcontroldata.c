@@ -0,0 +1,259 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcontroldata.c
+ *		Python module decoding PostgreSQL control files, with the same code
+ *		as the pg_controldata server module.
+ *
+ *	>>> import pgcontroldata
+ *	>>> cd = pgcontroldata.read("/srv/pgdata")
+ *	>>> cd["state"], cd["redo_pos"]
+ *
+ * read() accepts a data directory (str, bytes path or os.PathLike) or a
+ * control file image in any object supporting the buffer protocol, such
+ * as bytes, bytearray or memoryview.  Since bytes are taken as an image, a
+ * directory given as bytes must be wrapped, e.g. in pathlib.Path.  The GIL
+ * is released while the file is read and checked, so threads can scan
+ * many clusters at once.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres_fe.h"
+
+/*
+ * Undefine some things that get (re)defined in the Python headers.  We
+ * have already included all the system headers we need.
+ */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+#undef HAVE_STRERROR
+#undef HAVE_TZNAME
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "pgcd_common.h"
+
+
+static PyObject *pgcd_error;
+
+static PyObject *controldata_dict(const ControlFileData *cf);
+static int	set_item(PyObject *dict, const char *key, PyObject *value);
+static PyObject *pgcd_read(PyObject *self, PyObject *arg);
+
+
+/*
+ * Store value under key, stealing the reference; returns -1 on error.
+ */
+static int
+set_item(PyObject *dict, const char *key, PyObject *value)
+{
+	int			rc;
+
+	if (value == NULL)
+		return -1;
+	rc = PyDict_SetItemString(dict, key, value);
+	Py_DECREF(value);
+	return rc;
+}
+
+/*
+ * Build the result: typed fields named like the columns of
+ * pg_controldata_history(), WAL locations as linear byte positions, plus
+ * "settings", the (name, setting) pairs printed by pg_controldata.
+ */
+static PyObject *
+controldata_dict(const ControlFileData *cf)
+{
+	const CheckPoint *ckpt = &cf->checkPointCopy;
+	char		settings[PGCD_NUM_SETTINGS][PGCD_SETTING_LEN];
+	PyObject   *dict;
+	PyObject   *list;
+	int			i;
+
+	dict = PyDict_New();
+	if (dict == NULL)
+		return NULL;
+
+	if (set_item(dict, "pg_control_version",
+				 PyLong_FromUnsignedLong(cf->pg_control_version)) < 0 ||
+		set_item(dict, "catalog_version",
+				 PyLong_FromUnsignedLong(cf->catalog_version_no)) < 0 ||
+		set_item(dict, "system_identifier",
+				 PyLong_FromUnsignedLongLong(cf->system_identifier)) < 0 ||
+		set_item(dict, "state",
+				 PyUnicode_FromString(pgcd_dbstate(cf->state))) < 0 ||
+		set_item(dict, "control_time",
+				 PyLong_FromLongLong((long long) cf->time)) < 0 ||
+		set_item(dict, "checkpoint_pos",
+				 PyLong_FromLongLong(PGCD_LSN_POS(cf->checkPoint))) < 0 ||
+		set_item(dict, "prior_checkpoint_pos",
+				 PyLong_FromLongLong(PGCD_LSN_POS(cf->prevCheckPoint))) < 0 ||
+		set_item(dict, "redo_pos",
+				 PyLong_FromLongLong(PGCD_LSN_POS(ckpt->redo))) < 0 ||
+		set_item(dict, "timeline",
+				 PyLong_FromUnsignedLong(ckpt->ThisTimeLineID)) < 0 ||
+		set_item(dict, "next_xid",
+				 PyLong_FromLongLong(PGCD_FULL_XID(ckpt->nextXidEpoch,
+												   ckpt->nextXid))) < 0 ||
+		set_item(dict, "next_oid",
+				 PyLong_FromUnsignedLong(ckpt->nextOid)) < 0 ||
+		set_item(dict, "next_multixact",
+				 PyLong_FromUnsignedLong(ckpt->nextMulti)) < 0 ||
+		set_item(dict, "next_multi_offset",
+				 PyLong_FromUnsignedLong(ckpt->nextMultiOffset)) < 0 ||
+		set_item(dict, "oldest_xid",
+				 PyLong_FromUnsignedLong(ckpt->oldestXid)) < 0 ||
+		set_item(dict, "oldest_xid_dbid",
+				 PyLong_FromUnsignedLong(ckpt->oldestXidDB)) < 0 ||
+		set_item(dict, "oldest_active_xid",
+				 PyLong_FromUnsignedLong(ckpt->oldestActiveXid)) < 0 ||
+		set_item(dict, "checkpoint_time",
+				 PyLong_FromLongLong((long long) ckpt->time)) < 0 ||
+		set_item(dict, "min_recovery_pos",
+				 PyLong_FromLongLong(PGCD_LSN_POS(cf->minRecoveryPoint))) < 0 ||
+		set_item(dict, "backup_start_pos",
+				 PyLong_FromLongLong(PGCD_LSN_POS(cf->backupStartPoint))) < 0)
+	{
+		Py_DECREF(dict);
+		return NULL;
+	}
+
+	pgcd_format_settings(cf, settings);
+
+	list = PyList_New(PGCD_NUM_SETTINGS);
+	if (list == NULL)
+	{
+		Py_DECREF(dict);
+		return NULL;
+	}
+	for (i = 0; i < PGCD_NUM_SETTINGS; i++)
+	{
+		PyObject   *pair = Py_BuildValue("(ss)", pgcd_setting_names[i],
+										 settings[i]);
+
+		if (pair == NULL)
+		{
+			Py_DECREF(list);
+			Py_DECREF(dict);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, i, pair);
+	}
+	if (set_item(dict, "settings", list) < 0)
+	{
+		Py_DECREF(dict);
+		return NULL;
+	}
+
+	return dict;
+}
+
+PyDoc_STRVAR(pgcd_read_doc,
+"read(source) -> dict\n\n"
+"Decode the control file of the data directory source, or the control\n"
+"file image in the bytes-like object source.  Raises pgcontroldata.Error\n"
+"if it cannot be read or fails its CRC check.");
+
+static PyObject *
+pgcd_read(PyObject *self, PyObject *arg)
+{
+	ControlFileData cf;
+	char		errbuf[PGCD_ERRBUF_SIZE];
+	bool		ok;
+
+	if (PyObject_CheckBuffer(arg))
+	{
+		Py_buffer	view;
+
+		if (PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) < 0)
+			return NULL;
+
+		Py_BEGIN_ALLOW_THREADS
+		ok = pgcd_decode_controlfile(view.buf, (size_t) view.len, &cf,
+									 errbuf, sizeof(errbuf));
+		Py_END_ALLOW_THREADS
+
+		PyBuffer_Release(&view);
+	}
+	else
+	{
+		PyObject   *path;
+
+		if (!PyUnicode_FSConverter(arg, &path))
+			return NULL;
+
+		Py_BEGIN_ALLOW_THREADS
+		ok = pgcd_load_controlfile(PyBytes_AS_STRING(path), &cf,
+								   errbuf, sizeof(errbuf));
+		Py_END_ALLOW_THREADS
+
+		Py_DECREF(path);
+	}
+
+	if (!ok)
+	{
+		PyErr_SetString(pgcd_error, errbuf);
+		return NULL;
+	}
+
+	return controldata_dict(&cf);
+}
+
+static PyMethodDef pgcd_methods[] = {
+	{"read", pgcd_read, METH_O, pgcd_read_doc},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef pgcd_module = {
+	PyModuleDef_HEAD_INIT,
+	"pgcontroldata",
+	"Decode PostgreSQL " PG_MAJORVERSION " control files.",
+	-1,
+	pgcd_methods
+};
+
+PyMODINIT_FUNC
+PyInit_pgcontroldata(void)
+{
+	PyObject   *m;
+
+	/* before any thread can get to it */
+	pgcd_init();
+
+	m = PyModule_Create(&pgcd_module);
+	if (m == NULL)
+		return NULL;
+
+	pgcd_error = PyErr_NewException("pgcontroldata.Error", NULL, NULL);
+	Py_INCREF(pgcd_error);
+	if (PyModule_AddObject(m, "Error", pgcd_error) < 0 ||
+		PyModule_AddIntConstant(m, "PG_CONTROL_VERSION",
+								PG_CONTROL_VERSION) < 0)
+	{
+		Py_DECREF(pgcd_error);
+		Py_DECREF(m);
+		return NULL;
+	}
+
+	return m;
+}
@@ -0,0 +1,44 @@
+# $PostgreSQL$
+#
+# Build the pgcontroldata Python module against the PostgreSQL installation
+# whose pg_config is first in PATH (or given in PG_CONFIG):
+#
+#   python setup.py build_ext --inplace
+#   python setup.py install
+
+import os
+import subprocess
+
+try:
+    from setuptools import setup, Extension
+except ImportError:
+    from distutils.core import setup, Extension
+
+
+def pg_config(option):
+    cmd = [os.environ.get('PG_CONFIG', 'pg_config'), option]
+    return subprocess.check_output(cmd).decode().strip()
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+setup(
+    name='pgcontroldata',
+    version=pg_config('--version').split()[-1],
+    description='Decode PostgreSQL control files',
+    author='Joe Conway',
+    author_email='mail@joeconway.com',
+    ext_modules=[
+        Extension(
+            'pgcontroldata',
+            sources=['pgcontroldata.c',
+                     os.path.join(os.path.dirname(here), 'pgcd_common.c')],
+            define_macros=[('FRONTEND', None)],
+            include_dirs=[os.path.dirname(here),
+                          pg_config('--includedir-server'),
+                          pg_config('--includedir')],
+            library_dirs=[pg_config('--libdir')],
+            libraries=['pgport'],
+        ),
+    ],
+)
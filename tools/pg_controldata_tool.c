@@ -0,0 +1,932 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_controldata_tool.c
+ *		Command-line companion to the pg_controldata module, for looking
+ *		at the control files of many clusters at once.
+ *
+ * Usage: pg_controldata_tool MODE [OPTION]... DATADIR...
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres_fe.h"
+
+#include <unistd.h>
+#include <time.h>
+
+#ifdef ENABLE_THREAD_SAFETY
+#include <pthread.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#define HAVE_INOTIFY
+#endif
+
+#include "pgcd_common.h"
+#include "pg_controldata_tool.h"
+
+
+#define DEFAULT_JOBS	8
+#define DEFAULT_POLL	1
+
+/* width of the label column in pg_controldata's output */
+#define LABEL_WIDTH		38
+
+typedef void (*job_fn) (int item, void *arg);
+
+typedef struct job_queue
+{
+	int			nitems;
+	int			next;			/* next item to hand out */
+	job_fn		fn;
+	void	   *arg;
+#ifdef ENABLE_THREAD_SAFETY
+	pthread_mutex_t mutex;
+#endif
+} job_queue;
+
+const char *progname;
+static int	njobs = DEFAULT_JOBS;
+static bool ndjson = false;
+static int	poll_secs = DEFAULT_POLL;
+
+static void usage(void);
+static void run_jobs(int nitems, job_fn fn, void *arg);
+static int	parse_common_options(int argc, char **argv);
+static int	mode_rank(int argc, char **argv);
+static int	mode_dump(int argc, char **argv);
+static int	mode_watch(int argc, char **argv);
+static int	mode_archive(int argc, char **argv);
+static void json_string(const char *str);
+
+
+static void
+usage(void)
+{
+	printf(_("%s inspects the control files of many PostgreSQL clusters at once.\n\n"), progname);
+	printf(_("Usage:\n"));
+	printf(_("  %s rank [-j JOBS] DATADIR...\n"), progname);
+	printf(_("  %s dump [-j JOBS] [-F FORMAT] DATADIR...\n"), progname);
+	printf(_("  %s watch [-j JOBS] [-i SECS] DATADIR...\n"), progname);
+	printf(_("  %s archive [-j JOBS] [-F FORMAT] ARCHIVEDIR DATADIR...\n"), progname);
+	printf(_("  %s fpw [-s LSN] [-w WALDIR] [-t SECS,...] [-c SEGS,...] DATADIR\n"), progname);
+	printf(_("\nModes:\n"));
+	printf(_("  rank       rank standbys for promotion, most advanced first\n"));
+	printf(_("  dump       print each control file like pg_controldata does\n"));
+	printf(_("  watch      stream checkpoints and state changes as NDJSON\n"));
+	printf(_("  archive    check that ARCHIVEDIR holds each latest checkpoint's WAL\n"));
+	printf(_("  fpw        predict full-page image volume for other checkpoint settings\n"));
+	printf(_("\nOptions:\n"));
+	printf(_("  -j JOBS    read up to JOBS control files in parallel (default %d)\n"),
+		   DEFAULT_JOBS);
+	printf(_("  -F FORMAT  output format of dump and archive: text (default) or ndjson\n"));
+	printf(_("  -i SECS    polling interval of watch without inotify (default %d)\n"),
+		   DEFAULT_POLL);
+	printf(_("  -s LSN     start fpw at LSN instead of the latest REDO location\n"));
+	printf(_("  -w WALDIR  read WAL segments from WALDIR (default DATADIR/pg_xlog)\n"));
+	printf(_("  -t SECS    checkpoint_timeout values to simulate (default %s)\n"),
+		   FPW_DEFAULT_TIMEOUTS);
+	printf(_("  -c SEGS    checkpoint_segments values to simulate (default %s)\n"),
+		   FPW_DEFAULT_SEGMENTS);
+	printf(_("\nReport bugs to <mail@joeconway.com>.\n"));
+}
+
+void *
+pg_malloc(size_t size)
+{
+	void	   *result;
+
+	result = malloc(size ? size : 1);
+	if (!result)
+	{
+		fprintf(stderr, _("%s: out of memory\n"), progname);
+		exit(1);
+	}
+	return result;
+}
+
+#ifdef ENABLE_THREAD_SAFETY
+static void *
+job_worker(void *arg)
+{
+	job_queue  *q = (job_queue *) arg;
+
+	for (;;)
+	{
+		int			item;
+
+		pthread_mutex_lock(&q->mutex);
+		item = q->next++;
+		pthread_mutex_unlock(&q->mutex);
+
+		if (item >= q->nitems)
+			break;
+		q->fn(item, q->arg);
+	}
+
+	return NULL;
+}
+#endif
+
+/*
+ * Call fn(i, arg) for every i in [0, nitems), on up to njobs threads.
+ * Without thread support the items are simply processed in order.
+ */
+static void
+run_jobs(int nitems, job_fn fn, void *arg)
+{
+	job_queue	q;
+	int			i;
+
+	q.nitems = nitems;
+	q.next = 0;
+	q.fn = fn;
+	q.arg = arg;
+
+#ifdef ENABLE_THREAD_SAFETY
+	if (njobs > 1 && nitems > 1)
+	{
+		int			nthreads = Min(njobs, nitems);
+		pthread_t  *threads = pg_malloc(nthreads * sizeof(pthread_t));
+
+		pthread_mutex_init(&q.mutex, NULL);
+		for (i = 0; i < nthreads; i++)
+		{
+			if (pthread_create(&threads[i], NULL, job_worker, &q) != 0)
+			{
+				/* run with what we've got */
+				nthreads = i;
+				break;
+			}
+		}
+		if (nthreads > 0)
+		{
+			for (i = 0; i < nthreads; i++)
+				pthread_join(threads[i], NULL);
+			pthread_mutex_destroy(&q.mutex);
+			free(threads);
+			return;
+		}
+		pthread_mutex_destroy(&q.mutex);
+		free(threads);
+	}
+#endif
+
+	for (i = 0; i < nitems; i++)
+		fn(i, arg);
+}
+
+/*
+ * Parse options common to all modes; returns the index of the first
+ * non-option argument.
+ */
+static int
+parse_common_options(int argc, char **argv)
+{
+	int			c;
+
+	optind = 2;
+	while ((c = getopt(argc, argv, "j:F:i:")) != -1)
+	{
+		switch (c)
+		{
+			case 'i':
+				poll_secs = atoi(optarg);
+				if (poll_secs < 1)
+				{
+					fprintf(stderr, _("%s: invalid interval \"%s\"\n"),
+							progname, optarg);
+					exit(1);
+				}
+				break;
+			case 'F':
+				if (strcmp(optarg, "text") == 0)
+					ndjson = false;
+				else if (strcmp(optarg, "ndjson") == 0)
+					ndjson = true;
+				else
+				{
+					fprintf(stderr, _("%s: invalid output format \"%s\"\n"),
+							progname, optarg);
+					exit(1);
+				}
+				break;
+			case 'j':
+				njobs = atoi(optarg);
+				if (njobs < 1)
+				{
+					fprintf(stderr, _("%s: invalid number of jobs \"%s\"\n"),
+							progname, optarg);
+					exit(1);
+				}
+				break;
+			default:
+				fprintf(stderr, _("Try \"%s --help\" for more information.\n"),
+						progname);
+				exit(1);
+		}
+	}
+
+	if (optind >= argc)
+	{
+		fprintf(stderr, _("%s: no data directory specified\n"), progname);
+		fprintf(stderr, _("Try \"%s --help\" for more information.\n"),
+				progname);
+		exit(1);
+	}
+
+	return optind;
+}
+
+/*
+ * rank mode
+ */
+typedef struct rank_state
+{
+	char	  **dirs;
+	pgcdCandidate *cands;
+} rank_state;
+
+static void
+rank_one(int item, void *arg)
+{
+	rank_state *st = (rank_state *) arg;
+
+	pgcd_candidate_load(&st->cands[item], st->dirs[item]);
+}
+
+static int
+mode_rank(int argc, char **argv)
+{
+	rank_state	st;
+	int			first = parse_common_options(argc, argv);
+	int			n = argc - first;
+	int			i;
+	int			nok = 0;
+
+	st.dirs = argv + first;
+	st.cands = pg_malloc(n * sizeof(pgcdCandidate));
+
+	run_jobs(n, rank_one, &st);
+	pgcd_rank_candidates(st.cands, n);
+
+	printf("rank\tgap_bytes\ttimeline\treplay_location\trestartpoint\tstate\tdatadir\n");
+	for (i = 0; i < n; i++)
+	{
+		pgcdCandidate *c = &st.cands[i];
+
+		if (!c->ok)
+		{
+			fprintf(stderr, "%s: %s\n", progname, c->error);
+			continue;
+		}
+		nok++;
+		printf("%d\t" INT64_FORMAT "\t%u\t%X/%X\t%X/%X\t%s\t%s\n",
+			   c->rank, c->gap, c->timeline,
+			   (uint32) (c->replay_pos / XLogFileSize),
+			   (uint32) (c->replay_pos % XLogFileSize),
+			   c->control.checkPoint.xlogid, c->control.checkPoint.xrecoff,
+			   pgcd_dbstate(c->control.state), c->datadir);
+	}
+
+	free(st.cands);
+
+	/* fail if there is nothing to promote */
+	return (nok > 0) ? 0 : 1;
+}
+
+/*
+ * dump mode
+ */
+typedef struct dump_item
+{
+	const char *datadir;
+	bool		ok;
+	char		error[PGCD_ERRBUF_SIZE];
+	ControlFileData control;
+} dump_item;
+
+static void
+dump_one(int item, void *arg)
+{
+	dump_item  *d = &((dump_item *) arg)[item];
+
+	d->ok = pgcd_load_controlfile(d->datadir, &d->control,
+								  d->error, sizeof(d->error));
+}
+
+/*
+ * Print a JSON string literal.
+ */
+static void
+json_string(const char *str)
+{
+	const unsigned char *p;
+
+	putchar('"');
+	for (p = (const unsigned char *) str; *p; p++)
+	{
+		switch (*p)
+		{
+			case '"':
+				fputs("\\\"", stdout);
+				break;
+			case '\\':
+				fputs("\\\\", stdout);
+				break;
+			case '\n':
+				fputs("\\n", stdout);
+				break;
+			case '\t':
+				fputs("\\t", stdout);
+				break;
+			default:
+				if (*p < 0x20)
+					printf("\\u%04x", *p);
+				else
+					putchar(*p);
+		}
+	}
+	putchar('"');
+}
+
+/*
+ * Print the control files in argument order, either as text blocks in the
+ * format of pg_controldata, each preceded by a "Data directory" line of
+ * the same format and separated by blank lines, or as one JSON object per
+ * line.  The files are read in parallel; formatting uses localtime() and
+ * is therefore done here, on the main thread.
+ */
+static int
+mode_dump(int argc, char **argv)
+{
+	int			first = parse_common_options(argc, argv);
+	int			n = argc - first;
+	dump_item  *items;
+	int			i;
+	int			j;
+	int			nfailed = 0;
+
+	items = pg_malloc(n * sizeof(dump_item));
+	for (i = 0; i < n; i++)
+		items[i].datadir = argv[first + i];
+
+	run_jobs(n, dump_one, items);
+
+	for (i = 0; i < n; i++)
+	{
+		dump_item  *d = &items[i];
+		char		settings[PGCD_NUM_SETTINGS][PGCD_SETTING_LEN];
+
+		if (!d->ok)
+		{
+			nfailed++;
+			fprintf(stderr, "%s: %s\n", progname, d->error);
+			if (ndjson)
+			{
+				fputs("{\"datadir\":", stdout);
+				json_string(d->datadir);
+				fputs(",\"error\":", stdout);
+				json_string(d->error);
+				fputs("}\n", stdout);
+			}
+			continue;
+		}
+
+		pgcd_format_settings(&d->control, settings);
+
+		if (ndjson)
+		{
+			fputs("{\"datadir\":", stdout);
+			json_string(d->datadir);
+			fputs(",\"settings\":{", stdout);
+			for (j = 0; j < PGCD_NUM_SETTINGS; j++)
+			{
+				if (j > 0)
+					putchar(',');
+				json_string(pgcd_setting_names[j]);
+				putchar(':');
+				json_string(settings[j]);
+			}
+			fputs("}}\n", stdout);
+		}
+		else
+		{
+			if (i > nfailed)
+				putchar('\n');
+			printf("%-*s%s\n", LABEL_WIDTH, "Data directory:", d->datadir);
+			for (j = 0; j < PGCD_NUM_SETTINGS; j++)
+			{
+				char		label[PGCD_SETTING_LEN];
+
+				snprintf(label, sizeof(label), "%s:", pgcd_setting_names[j]);
+				printf("%-*s%s\n", LABEL_WIDTH, label, settings[j]);
+			}
+		}
+	}
+
+	free(items);
+
+	return (nfailed > 0) ? 1 : 0;
+}
+
+/*
+ * watch mode
+ */
+
+/* typed fields of a watch record, in output order */
+typedef enum watch_field
+{
+	WF_CONTROL_TIME,
+	WF_CHECKPOINT_POS,
+	WF_PRIOR_CHECKPOINT_POS,
+	WF_REDO_POS,
+	WF_TIMELINE,
+	WF_NEXT_XID,
+	WF_NEXT_OID,
+	WF_NEXT_MULTIXACT,
+	WF_NEXT_MULTI_OFFSET,
+	WF_OLDEST_XID,
+	WF_OLDEST_XID_DBID,
+	WF_OLDEST_ACTIVE_XID,
+	WF_CHECKPOINT_TIME,
+	WF_MIN_RECOVERY_POS,
+	WF_BACKUP_START_POS,
+	WF_NUM
+} watch_field;
+
+static const struct
+{
+	const char *name;
+	bool		delta;			/* does a difference make sense? */
+} watch_fields[WF_NUM] =
+{
+	{"control_time", true},
+	{"checkpoint_pos", true},
+	{"prior_checkpoint_pos", true},
+	{"redo_pos", true},
+	{"timeline", false},
+	{"next_xid", true},
+	{"next_oid", false},
+	{"next_multixact", true},
+	{"next_multi_offset", true},
+	{"oldest_xid", true},
+	{"oldest_xid_dbid", false},
+	{"oldest_active_xid", true},
+	{"checkpoint_time", true},
+	{"min_recovery_pos", true},
+	{"backup_start_pos", true}
+};
+
+typedef struct watch_item
+{
+	const char *datadir;
+	bool		ok;				/* have a valid image */
+	char		error[PGCD_ERRBUF_SIZE];
+	ControlFileData control;
+	int			wd;				/* inotify watch descriptor, or -1 */
+} watch_item;
+
+static void
+watch_values(const ControlFileData *cf, int64 *v)
+{
+	const CheckPoint *ckpt = &cf->checkPointCopy;
+
+	v[WF_CONTROL_TIME] = (int64) cf->time;
+	v[WF_CHECKPOINT_POS] = PGCD_LSN_POS(cf->checkPoint);
+	v[WF_PRIOR_CHECKPOINT_POS] = PGCD_LSN_POS(cf->prevCheckPoint);
+	v[WF_REDO_POS] = PGCD_LSN_POS(ckpt->redo);
+	v[WF_TIMELINE] = ckpt->ThisTimeLineID;
+	v[WF_NEXT_XID] = PGCD_FULL_XID(ckpt->nextXidEpoch, ckpt->nextXid);
+	v[WF_NEXT_OID] = ckpt->nextOid;
+	v[WF_NEXT_MULTIXACT] = ckpt->nextMulti;
+	v[WF_NEXT_MULTI_OFFSET] = ckpt->nextMultiOffset;
+	v[WF_OLDEST_XID] = ckpt->oldestXid;
+	v[WF_OLDEST_XID_DBID] = ckpt->oldestXidDB;
+	v[WF_OLDEST_ACTIVE_XID] = ckpt->oldestActiveXid;
+	v[WF_CHECKPOINT_TIME] = (int64) ckpt->time;
+	v[WF_MIN_RECOVERY_POS] = PGCD_LSN_POS(cf->minRecoveryPoint);
+	v[WF_BACKUP_START_POS] = PGCD_LSN_POS(cf->backupStartPoint);
+}
+
+static void
+watch_load(int item, void *arg)
+{
+	watch_item *w = &((watch_item *) arg)[item];
+
+	w->ok = pgcd_load_controlfile(w->datadir, &w->control,
+								  w->error, sizeof(w->error));
+}
+
+/*
+ * Print one record: every field for the first image of a directory
+ * ("initial"), otherwise only the fields that changed and, where that makes
+ * sense, by how much.
+ */
+static void
+watch_emit(const watch_item *w, const ControlFileData *old,
+		   const char *event)
+{
+	const ControlFileData *cf = &w->control;
+	int64		nv[WF_NUM];
+	int64		ov[WF_NUM];
+	int			i;
+	bool		first;
+
+	watch_values(cf, nv);
+	if (old)
+		watch_values(old, ov);
+
+	printf("{\"time\":%ld,\"datadir\":", (long) time(NULL));
+	json_string(w->datadir);
+	printf(",\"event\":\"%s\",\"changed\":{", event);
+
+	first = true;
+	if (!old || old->state != cf->state)
+	{
+		fputs("\"state\":", stdout);
+		json_string(pgcd_dbstate(cf->state));
+		first = false;
+	}
+	for (i = 0; i < WF_NUM; i++)
+	{
+		if (old && nv[i] == ov[i])
+			continue;
+		printf("%s\"%s\":" INT64_FORMAT, first ? "" : ",",
+			   watch_fields[i].name, nv[i]);
+		first = false;
+	}
+
+	fputs("}", stdout);
+
+	if (old)
+	{
+		fputs(",\"delta\":{", stdout);
+		first = true;
+		for (i = 0; i < WF_NUM; i++)
+		{
+			if (nv[i] == ov[i] || !watch_fields[i].delta)
+				continue;
+			printf("%s\"%s\":" INT64_FORMAT, first ? "" : ",",
+				   watch_fields[i].name, nv[i] - ov[i]);
+			first = false;
+		}
+		fputs("}", stdout);
+	}
+
+	fputs("}\n", stdout);
+	fflush(stdout);
+}
+
+/*
+ * Reread one directory's control file and report a new checkpoint or a
+ * state change.  A file caught halfway through being rewritten fails its
+ * CRC check and is simply read again on the next event.  w->control is the
+ * image last emitted, so that every record's changes and deltas are
+ * relative to what the consumer has seen; rewrites that are not reported,
+ * e.g. of minRecoveryPoint on a standby, are folded into the next record.
+ */
+static void
+watch_check(watch_item *w)
+{
+	ControlFileData old = w->control;
+	ControlFileData cur;
+	const char *event;
+
+	if (!pgcd_load_controlfile(w->datadir, &cur,
+							   w->error, sizeof(w->error)))
+		return;
+
+	if (!w->ok)
+		event = "initial";
+	else if (cur.checkPoint.xlogid != old.checkPoint.xlogid ||
+			 cur.checkPoint.xrecoff != old.checkPoint.xrecoff)
+		event = "checkpoint";
+	else if (cur.state != old.state)
+		event = "state";
+	else
+		return;
+
+	w->control = cur;
+	watch_emit(w, w->ok ? &old : NULL, event);
+	w->ok = true;
+}
+
+/*
+ * Emit the current image of every directory, then one record per new
+ * checkpoint or state change until killed.  On Linux, inotify on each
+ * global/ directory tells us when pg_control was rewritten; directories
+ * that cannot be watched are reread every poll interval, and so are all of
+ * them elsewhere or if inotify fails.
+ */
+static int
+mode_watch(int argc, char **argv)
+{
+	int			first = parse_common_options(argc, argv);
+	int			n = argc - first;
+	watch_item *items;
+	int			i;
+#ifdef HAVE_INOTIFY
+	int			ifd;
+	union
+	{
+		struct inotify_event ev;	/* for alignment */
+		char		data[sizeof(struct inotify_event) + MAXPGPATH];
+	}			buf;
+#endif
+
+	items = pg_malloc(n * sizeof(watch_item));
+	for (i = 0; i < n; i++)
+	{
+		items[i].datadir = argv[first + i];
+		items[i].wd = -1;
+	}
+
+	run_jobs(n, watch_load, items);
+
+	for (i = 0; i < n; i++)
+	{
+		if (items[i].ok)
+			watch_emit(&items[i], NULL, "initial");
+		else
+			fprintf(stderr, "%s: %s\n", progname, items[i].error);
+	}
+
+#ifdef HAVE_INOTIFY
+	ifd = inotify_init();
+	if (ifd >= 0)
+	{
+		int			unwatched = 0;
+		time_t		next_poll = time(NULL) + poll_secs;
+
+		for (i = 0; i < n; i++)
+		{
+			char		path[MAXPGPATH];
+
+			snprintf(path, sizeof(path), "%s/global", items[i].datadir);
+			items[i].wd = inotify_add_watch(ifd, path,
+											IN_CLOSE_WRITE | IN_MODIFY |
+											IN_MOVED_TO | IN_CREATE);
+			if (items[i].wd < 0)
+			{
+				fprintf(stderr, _("%s: could not watch \"%s\": %s\n"),
+						progname, path, strerror(errno));
+				unwatched++;
+			}
+		}
+
+		/* directories we could not watch are polled in between events */
+		while (unwatched < n)
+		{
+			ssize_t		len;
+			char	   *p;
+
+			if (unwatched > 0)
+			{
+				struct pollfd pfd;
+				time_t		now = time(NULL);
+				int			rc;
+
+				if (now >= next_poll)
+				{
+					for (i = 0; i < n; i++)
+					{
+						if (items[i].wd < 0)
+							watch_check(&items[i]);
+					}
+					next_poll = now + poll_secs;
+				}
+
+				pfd.fd = ifd;
+				pfd.events = POLLIN;
+				pfd.revents = 0;
+				rc = poll(&pfd, 1, (int) (next_poll - now) * 1000);
+				if (rc < 0 && errno != EINTR)
+				{
+					fprintf(stderr, _("%s: could not wait for inotify events: %s\n"),
+							progname, strerror(errno));
+					break;
+				}
+				if (rc <= 0)
+					continue;
+			}
+
+			len = read(ifd, buf.data, sizeof(buf.data));
+			if (len <= 0)
+			{
+				if (len < 0 && errno == EINTR)
+					continue;
+				fprintf(stderr, _("%s: could not read inotify events: %s\n"),
+						progname, strerror(errno));
+				break;
+			}
+
+			for (p = buf.data; p < buf.data + len;)
+			{
+				struct inotify_event *ev = (struct inotify_event *) p;
+
+				p += sizeof(struct inotify_event) + ev->len;
+
+				if (ev->len == 0 || strcmp(ev->name, "pg_control") != 0)
+					continue;
+				for (i = 0; i < n; i++)
+				{
+					if (items[i].wd == ev->wd)
+						watch_check(&items[i]);
+				}
+			}
+		}
+
+		/* fall back to polling, like without inotify */
+		close(ifd);
+		for (i = 0; i < n; i++)
+			watch_check(&items[i]);
+	}
+	fprintf(stderr, _("%s: inotify unavailable, polling every %d s\n"),
+			progname, poll_secs);
+#endif
+
+	for (;;)
+	{
+		sleep(poll_secs);
+		for (i = 0; i < n; i++)
+			watch_check(&items[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * archive mode
+ */
+typedef struct archive_item
+{
+	const char *datadir;
+	const char *archive_dir;
+	bool		loaded;
+	char		error[PGCD_ERRBUF_SIZE];
+	pgcdArchiveCheck check;
+} archive_item;
+
+static void
+archive_one(int item, void *arg)
+{
+	archive_item *a = &((archive_item *) arg)[item];
+	ControlFileData cf;
+
+	a->loaded = pgcd_load_controlfile(a->datadir, &cf,
+									  a->error, sizeof(a->error));
+	if (a->loaded)
+		pgcd_check_archive(a->archive_dir, &cf, &a->check);
+}
+
+/*
+ * Check the archive for the latest checkpoint of each data directory, e.g.
+ * of many restored backups, and print one line per directory in argument
+ * order.  Each job streams at most the segments holding one REDO location
+ * and checkpoint record, a page at a time, so memory stays small however
+ * many jobs run.
+ */
+static int
+mode_archive(int argc, char **argv)
+{
+	int			first = parse_common_options(argc, argv);
+	const char *archive_dir = argv[first++];
+	int			n = argc - first;
+	archive_item *items;
+	int			i;
+	int			nfailed = 0;
+
+	if (n < 1)
+	{
+		fprintf(stderr, _("%s: no data directory specified\n"), progname);
+		fprintf(stderr, _("Try \"%s --help\" for more information.\n"),
+				progname);
+		exit(1);
+	}
+
+	items = pg_malloc(n * sizeof(archive_item));
+	for (i = 0; i < n; i++)
+	{
+		items[i].datadir = argv[first + i];
+		items[i].archive_dir = archive_dir;
+	}
+
+	run_jobs(n, archive_one, items);
+
+	if (!ndjson)
+		printf("status\tredo_segment\tredo_offset\tcheckpoint_segment\tcheckpoint_offset\tbytes_read\tdatadir\n");
+	for (i = 0; i < n; i++)
+	{
+		archive_item *a = &items[i];
+		pgcdArchiveCheck *c = &a->check;
+		const char *error = a->loaded ? c->error : a->error;
+
+		if (!a->loaded || !c->ok)
+		{
+			nfailed++;
+			fprintf(stderr, "%s: %s: %s\n", progname, a->datadir, error);
+		}
+		if (!a->loaded)
+		{
+			if (ndjson)
+			{
+				fputs("{\"datadir\":", stdout);
+				json_string(a->datadir);
+				fputs(",\"ok\":false,\"error\":", stdout);
+				json_string(error);
+				fputs("}\n", stdout);
+			}
+			continue;
+		}
+
+		if (ndjson)
+		{
+			fputs("{\"datadir\":", stdout);
+			json_string(a->datadir);
+			printf(",\"ok\":%s,\"redo_segment\":\"%s\",\"redo_offset\":%u,"
+				   "\"checkpoint_segment\":\"%s\",\"checkpoint_offset\":%u,"
+				   "\"compressed\":%s,\"bytes_read\":" INT64_FORMAT,
+				   c->ok ? "true" : "false",
+				   c->redo_segment, c->redo_offset,
+				   c->checkpoint_segment, c->checkpoint_offset,
+				   c->compressed ? "true" : "false", c->bytes_read);
+			if (!c->ok)
+			{
+				fputs(",\"error\":", stdout);
+				json_string(error);
+			}
+			fputs("}\n", stdout);
+		}
+		else
+			printf("%s\t%s\t%u\t%s\t%u\t" INT64_FORMAT "\t%s\n",
+				   c->ok ? "ok" : "FAILED",
+				   c->redo_segment, c->redo_offset,
+				   c->checkpoint_segment, c->checkpoint_offset,
+				   c->bytes_read, a->datadir);
+	}
+
+	free(items);
+
+	return (nfailed > 0) ? 1 : 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	progname = get_progname(argv[0]);
+	pgcd_init();
+
+	if (argc < 2)
+	{
+		usage();
+		exit(1);
+	}
+
+	if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-?") == 0)
+	{
+		usage();
+		exit(0);
+	}
+	if (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-V") == 0)
+	{
+		puts("pg_controldata_tool (PostgreSQL) " PG_VERSION);
+		exit(0);
+	}
+
+	if (strcmp(argv[1], "rank") == 0)
+		return mode_rank(argc, argv);
+	if (strcmp(argv[1], "dump") == 0)
+		return mode_dump(argc, argv);
+	if (strcmp(argv[1], "watch") == 0)
+		return mode_watch(argc, argv);
+	if (strcmp(argv[1], "archive") == 0)
+		return mode_archive(argc, argv);
+	if (strcmp(argv[1], "fpw") == 0)
+		return mode_fpw(argc, argv);
+
+	fprintf(stderr, _("%s: unrecognized mode \"%s\"\n"), progname, argv[1]);
+	fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
+	exit(1);
+}
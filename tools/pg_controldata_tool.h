@@ -0,0 +1,41 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_controldata_tool.h
+ *		Definitions shared by the modes of pg_controldata_tool.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+#ifndef PG_CONTROLDATA_TOOL_H
+#define PG_CONTROLDATA_TOOL_H
+
+#define FPW_DEFAULT_TIMEOUTS	"300,900,1800,3600"
+#define FPW_DEFAULT_SEGMENTS	"3,16,64,256"
+
+extern const char *progname;
+
+/* pg_controldata_tool.c */
+extern void *pg_malloc(size_t size);
+
+/* pgcd_fpw.c */
+extern int	mode_fpw(int argc, char **argv);
+
+#endif   /* PG_CONTROLDATA_TOOL_H */
@@ -0,0 +1,715 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_fpw.c
+ *		fpw mode of pg_controldata_tool: predict the full-page image volume
+ *		of other checkpoint_timeout and checkpoint_segments settings.
+ *
+ * With full_page_writes on, the first change of each block after a
+ * checkpoint's redo point logs an image of the whole block.  We read the
+ * WAL from the latest REDO location (or -s) to its end, note the blocks
+ * every record touches, and replay that stream against simulated
+ * checkpoints: a block costs an image when it is first touched in a
+ * simulated interval.  A simulated checkpoint happens when checkpoint_timeout
+ * has passed or, like in the server, when the segment checkpoint_segments
+ * - 1 past the redo segment is completed, counting simulated WAL volume.
+ *
+ * Backup blocks show every block at its first change after the actual
+ * checkpoints, of any resource manager.  Later changes in the same actual
+ * interval are only seen for heap changes and B-tree insertions, which name
+ * their target block; changes of other kinds are invisible, so settings with
+ * shorter intervals than the actual ones are underestimated somewhat.
+ * The clock is taken from commit and checkpoint records.
+ *
+ * Copyright (c) 2010, PostgreSQL Global Development Group
+ * ALL RIGHTS RESERVED;
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without a written agreement
+ * is hereby granted, provided that the above copyright notice and this
+ * paragraph and the following two paragraphs appear in all copies.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR DISTRIBUTORS BE LIABLE TO ANY PARTY FOR
+ * DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+ * LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS
+ * DOCUMENTATION, EVEN IF THE AUTHOR OR DISTRIBUTORS HAVE BEEN ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND DISTRIBUTORS SPECIFICALLY DISCLAIMS ANY WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS
+ * ON AN "AS IS" BASIS, AND THE AUTHOR AND DISTRIBUTORS HAS NO OBLIGATIONS TO
+ * PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ */
+
+#include "postgres_fe.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "access/htup.h"
+#include "access/rmgr.h"
+#include "access/xact.h"
+
+#include "pgcd_common.h"
+#include "pg_controldata_tool.h"
+
+
+/* from access/nbtree.h, which client programs cannot include */
+#define BTREE_INSERT_LEAF	0x00
+#define BTREE_INSERT_UPPER	0x10
+
+/* blocks one record can touch: backup blocks plus two named in the data */
+#define MAX_TOUCHES			(XLR_MAX_BKP_BLOCKS + 2)
+
+#define UNKNOWN_TIME		(-1.0)
+
+/*
+ * The WAL segments of one timeline in a directory, read a page at a time.
+ */
+typedef struct wal_dir
+{
+	const char *waldir;
+	TimeLineID	tli;
+	int			fd;				/* open segment, or -1 */
+	uint32		log;			/* ... and its number */
+	uint32		seg;
+} wal_dir;
+
+typedef struct block_key
+{
+	Oid			spc;
+	Oid			db;
+	Oid			rel;
+	int32		fork;
+	BlockNumber	block;
+} block_key;
+
+typedef struct block_touch
+{
+	block_key	key;
+	uint32		image_len;		/* backup block length, 0 if no image */
+} block_touch;
+
+/*
+ * Hash table entry of a block; last[s] is the interval of simulation s in
+ * which the block last cost an image, or -1.
+ */
+typedef struct block_entry
+{
+	block_key	key;
+	uint32		image_len;		/* last image seen, 0 if none yet */
+	bool		used;
+	int32		last[1];		/* VARIABLE LENGTH ARRAY */
+} block_entry;
+
+typedef struct block_table
+{
+	char	   *entries;
+	size_t		entry_size;
+	uint64		capacity;		/* a power of two */
+	uint64		count;
+	int			nsims;
+} block_table;
+
+typedef struct walsim
+{
+	int			timeout;		/* checkpoint_timeout in s, or 0 */
+	int			segments;		/* checkpoint_segments, or 0 */
+	int32		interval;		/* number of the current interval */
+	double		start_time;		/* when it began */
+	int64		redo_pos;		/* simulated position where it began */
+	int64		pos;			/* simulated WAL position */
+	int64		images;
+	int64		image_bytes;
+} walsim;
+
+static int	parse_list(const char *str, int **result);
+static bool read_wal_page(void *arg, int64 pagepos, char *page,
+						  char *errbuf, size_t errlen);
+static int	record_touches(const XLogRecord *rec, block_touch *touches,
+						   int64 *image_bytes, double *rec_time);
+static void block_reserve(block_table *t, int n);
+static block_entry *block_lookup(block_table *t, const block_key *key);
+static void walsim_record(walsim *sims, int nsims, block_table *t,
+						  const block_touch *touches, int ntouches,
+						  int64 data_bytes, double now, double mean_image);
+
+
+/*
+ * Parse a comma-separated list of non-negative integers.
+ */
+static int
+parse_list(const char *str, int **result)
+{
+	const char *p;
+	int			n = 1;
+	int			i = 0;
+
+	for (p = str; *p; p++)
+		if (*p == ',')
+			n++;
+
+	*result = pg_malloc(n * sizeof(int));
+
+	for (p = str; i < n; i++)
+	{
+		char	   *end;
+		long		val = strtol(p, &end, 10);
+
+		if (end == p || val < 0 || val > INT_MAX ||
+			(*end != ',' && *end != '\0'))
+		{
+			fprintf(stderr, _("%s: invalid list \"%s\"\n"), progname, str);
+			exit(1);
+		}
+		(*result)[i] = (int) val;
+		p = end + 1;
+	}
+
+	return n;
+}
+
+/*
+ * Read the WAL page at linear position pagepos from the segment files; the
+ * reader checks the page header.  A missing segment is the end of WAL.
+ */
+static bool
+read_wal_page(void *arg, int64 pagepos, char *page,
+			  char *errbuf, size_t errlen)
+{
+	wal_dir    *d = (wal_dir *) arg;
+	uint32		log = (uint32) (pagepos / XLogFileSize);
+	uint32		seg = (uint32) ((pagepos % XLogFileSize) / XLogSegSize);
+	off_t		offset = (off_t) (pagepos % XLogSegSize);
+
+	if (d->fd < 0 || d->log != log || d->seg != seg)
+	{
+		char		fname[MAXFNAMELEN];
+		char		path[MAXPGPATH];
+
+		if (d->fd >= 0)
+			close(d->fd);
+
+		XLogFileName(fname, d->tli, log, seg);
+		snprintf(path, sizeof(path), "%s/%s", d->waldir, fname);
+		d->fd = open(path, O_RDONLY | PG_BINARY, 0);
+		if (d->fd < 0)
+			return false;
+		d->log = log;
+		d->seg = seg;
+	}
+
+	return lseek(d->fd, offset, SEEK_SET) == offset &&
+		read(d->fd, page, XLOG_BLCKSZ) == XLOG_BLCKSZ;
+}
+
+static void
+set_key(block_key *key, const RelFileNode *node, int32 fork, BlockNumber block)
+{
+	memset(key, 0, sizeof(block_key));
+	key->spc = node->spcNode;
+	key->db = node->dbNode;
+	key->rel = node->relNode;
+	key->fork = fork;
+	key->block = block;
+}
+
+/* ItemPointerGetBlockNumber() asserts, which client programs cannot */
+#define TID_BLOCK(tid) \
+	(((BlockNumber) (tid).ip_blkid.bi_hi << 16) | (uint16) (tid).ip_blkid.bi_lo)
+
+/*
+ * Collect the blocks rec touches, the bytes of its backup blocks and, if
+ * it carries a timestamp, its time as a Unix epoch.
+ */
+static int
+record_touches(const XLogRecord *rec, block_touch *touches,
+			   int64 *image_bytes, double *rec_time)
+{
+	const char *data = XLogRecGetData(rec);
+	const char *blk = data + rec->xl_len;
+	uint8		info = rec->xl_info & ~XLR_INFO_MASK;
+	int			n = 0;
+	int			i;
+
+	*image_bytes = 0;
+
+	for (i = 0; i < XLR_MAX_BKP_BLOCKS; i++)
+	{
+		BkpBlock	bkpb;
+		uint32		blen;
+
+		if (!(rec->xl_info & XLR_SET_BKP_BLOCK(i)))
+			continue;
+
+		memcpy(&bkpb, blk, sizeof(BkpBlock));
+		blen = sizeof(BkpBlock) + BLCKSZ - bkpb.hole_length;
+		set_key(&touches[n].key, &bkpb.node, bkpb.fork, bkpb.block);
+		touches[n++].image_len = blen;
+		*image_bytes += blen;
+		blk += blen;
+	}
+
+	switch (rec->xl_rmid)
+	{
+		case RM_HEAP_ID:
+			switch (info & XLOG_HEAP_OPMASK)
+			{
+				case XLOG_HEAP_UPDATE:
+				case XLOG_HEAP_HOT_UPDATE:
+					if (rec->xl_len >= sizeof(xl_heap_update))
+					{
+						xl_heap_update xlrec;
+
+						memcpy(&xlrec, data, sizeof(xl_heap_update));
+						set_key(&touches[n].key, &xlrec.target.node,
+								MAIN_FORKNUM, TID_BLOCK(xlrec.newtid));
+						touches[n++].image_len = 0;
+					}
+					/* FALLTHROUGH */
+				case XLOG_HEAP_INSERT:
+				case XLOG_HEAP_DELETE:
+				case XLOG_HEAP_LOCK:
+				case XLOG_HEAP_INPLACE:
+					if (rec->xl_len >= sizeof(xl_heaptid))
+					{
+						xl_heaptid	target;
+
+						memcpy(&target, data, sizeof(xl_heaptid));
+						set_key(&touches[n].key, &target.node,
+								MAIN_FORKNUM, TID_BLOCK(target.tid));
+						touches[n++].image_len = 0;
+					}
+					break;
+			}
+			break;
+
+		case RM_BTREE_ID:
+			/* xl_btree_insert starts with an xl_btreetid, same layout */
+			if ((info == BTREE_INSERT_LEAF || info == BTREE_INSERT_UPPER) &&
+				rec->xl_len >= sizeof(xl_heaptid))
+			{
+				xl_heaptid	target;
+
+				memcpy(&target, data, sizeof(xl_heaptid));
+				set_key(&touches[n].key, &target.node,
+						MAIN_FORKNUM, TID_BLOCK(target.tid));
+				touches[n++].image_len = 0;
+			}
+			break;
+
+		case RM_XACT_ID:
+			if (info == XLOG_XACT_COMMIT &&
+				rec->xl_len >= sizeof(TimestampTz))
+			{
+				TimestampTz	t;
+
+				memcpy(&t, data, sizeof(TimestampTz));
+#ifdef HAVE_INT64_TIMESTAMP
+				*rec_time = (double) t / USECS_PER_SEC;
+#else
+				*rec_time = t;
+#endif
+				*rec_time += (double) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY;
+			}
+			break;
+
+		case RM_XLOG_ID:
+			if ((info == XLOG_CHECKPOINT_SHUTDOWN ||
+				 info == XLOG_CHECKPOINT_ONLINE) &&
+				rec->xl_len >= sizeof(CheckPoint))
+			{
+				CheckPoint	ckpt;
+
+				memcpy(&ckpt, data, sizeof(CheckPoint));
+				*rec_time = (double) ckpt.time;
+			}
+			break;
+	}
+
+	return n;
+}
+
+static uint64
+block_hash(const block_key *key)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	uint64		h = UINT64CONST(14695981039346656037);
+	size_t		i;
+
+	for (i = 0; i < sizeof(block_key); i++)
+		h = (h ^ p[i]) * UINT64CONST(1099511628211);
+
+	return h;
+}
+
+#define ENTRY_AT(t, i)	((block_entry *) ((t)->entries + (i) * (t)->entry_size))
+
+/*
+ * Make room for n more entries; open addressing, doubled at half load.
+ * Growing moves the entries, so callers holding entry pointers reserve
+ * room for all their lookups first.
+ */
+static void
+block_reserve(block_table *t, int n)
+{
+	uint64		i;
+
+	if ((t->count + n) * 2 >= t->capacity)
+	{
+		block_table old = *t;
+
+		t->capacity = Max(old.capacity * 2, 1024);
+		while ((t->count + n) * 2 >= t->capacity)
+			t->capacity *= 2;
+		t->entries = pg_malloc(t->capacity * t->entry_size);
+		memset(t->entries, 0, t->capacity * t->entry_size);
+
+		for (i = 0; i < old.capacity; i++)
+		{
+			block_entry *src = ENTRY_AT(&old, i);
+			uint64		j;
+
+			if (!src->used)
+				continue;
+			j = block_hash(&src->key) & (t->capacity - 1);
+			while (ENTRY_AT(t, j)->used)
+				j = (j + 1) & (t->capacity - 1);
+			memcpy(ENTRY_AT(t, j), src, t->entry_size);
+		}
+		free(old.entries);
+	}
+}
+
+/*
+ * Find the entry of key, adding a new one if needed; the caller has
+ * reserved room for it.
+ */
+static block_entry *
+block_lookup(block_table *t, const block_key *key)
+{
+	uint64		i;
+	block_entry *e;
+	int			s;
+
+	i = block_hash(key) & (t->capacity - 1);
+	for (;;)
+	{
+		e = ENTRY_AT(t, i);
+		if (!e->used)
+			break;
+		if (memcmp(&e->key, key, sizeof(block_key)) == 0)
+			return e;
+		i = (i + 1) & (t->capacity - 1);
+	}
+
+	e->key = *key;
+	e->image_len = 0;
+	e->used = true;
+	for (s = 0; s < t->nsims; s++)
+		e->last[s] = -1;
+	t->count++;
+
+	return e;
+}
+
+/*
+ * Advance every simulation by one record: start a new interval if a
+ * checkpoint is due, then charge an image for each block first touched in
+ * the current interval.
+ */
+static void
+walsim_record(walsim *sims, int nsims, block_table *t,
+			  const block_touch *touches, int ntouches,
+			  int64 data_bytes, double now, double mean_image)
+{
+	block_entry *entries[MAX_TOUCHES];
+	int			i;
+	int			s;
+
+	/* no growing between the lookups, entries[] points into the table */
+	block_reserve(t, ntouches);
+
+	for (i = 0; i < ntouches; i++)
+	{
+		entries[i] = block_lookup(t, &touches[i].key);
+		if (touches[i].image_len > 0)
+			entries[i]->image_len = touches[i].image_len;
+	}
+
+	for (s = 0; s < nsims; s++)
+	{
+		walsim	   *sim = &sims[s];
+		int64		bytes = data_bytes;
+		bool		due = false;
+
+		if (sim->start_time == UNKNOWN_TIME)
+			sim->start_time = now;
+
+		if (sim->timeout > 0 && now != UNKNOWN_TIME &&
+			now - sim->start_time >= sim->timeout)
+			due = true;
+
+		if (sim->segments > 0 &&
+			sim->pos / XLogSegSize >=
+			sim->redo_pos / XLogSegSize + sim->segments)
+			due = true;
+
+		if (due)
+		{
+			sim->interval++;
+			sim->start_time = now;
+			sim->redo_pos = sim->pos;
+		}
+
+		for (i = 0; i < ntouches; i++)
+		{
+			block_entry *e = entries[i];
+			int64		len;
+
+			if (e->last[s] == sim->interval)
+				continue;
+			e->last[s] = sim->interval;
+
+			len = e->image_len > 0 ? e->image_len : (int64) mean_image;
+			sim->images++;
+			sim->image_bytes += len;
+			bytes += len;
+		}
+
+		sim->pos += bytes;
+	}
+}
+
+/*
+ * fpw mode
+ */
+int
+mode_fpw(int argc, char **argv)
+{
+	const char *timeouts_arg = FPW_DEFAULT_TIMEOUTS;
+	const char *segments_arg = FPW_DEFAULT_SEGMENTS;
+	const char *start_arg = NULL;
+	char		waldir[MAXPGPATH];
+	char		errbuf[PGCD_ERRBUF_SIZE];
+	ControlFileData cf;
+	wal_dir		dir;
+	pgcdWalReader r;
+	block_table	table;
+	walsim	   *sims;
+	int		   *timeouts;
+	int		   *segments;
+	int			ntimeouts;
+	int			nsegments;
+	int			nsims;
+	int64		start_pos;
+	int64		pos;
+	int64		nrecords = 0;
+	int64		images = 0;
+	int64		image_bytes = 0;
+	int			checkpoints = 0;
+	double		first_time = UNKNOWN_TIME;
+	double		now = UNKNOWN_TIME;
+	int			c;
+	int			i;
+	int			j;
+
+	waldir[0] = '\0';
+
+	optind = 2;
+	while ((c = getopt(argc, argv, "s:w:t:c:")) != -1)
+	{
+		switch (c)
+		{
+			case 's':
+				start_arg = optarg;
+				break;
+			case 'w':
+				strlcpy(waldir, optarg, sizeof(waldir));
+				break;
+			case 't':
+				timeouts_arg = optarg;
+				break;
+			case 'c':
+				segments_arg = optarg;
+				break;
+			default:
+				fprintf(stderr, _("Try \"%s --help\" for more information.\n"),
+						progname);
+				exit(1);
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, _("%s: fpw needs exactly one data directory\n"),
+				progname);
+		fprintf(stderr, _("Try \"%s --help\" for more information.\n"),
+				progname);
+		exit(1);
+	}
+
+	if (!pgcd_load_controlfile(argv[optind], &cf, errbuf, sizeof(errbuf)))
+	{
+		fprintf(stderr, "%s: %s\n", progname, errbuf);
+		exit(1);
+	}
+	if (cf.xlog_seg_size != XLogSegSize || cf.blcksz != BLCKSZ ||
+		cf.xlog_blcksz != XLOG_BLCKSZ)
+	{
+		fprintf(stderr, _("%s: cluster was built with a different block or WAL segment size\n"),
+				progname);
+		exit(1);
+	}
+
+	if (waldir[0] == '\0')
+		snprintf(waldir, sizeof(waldir), "%s/pg_xlog", argv[optind]);
+
+	if (start_arg)
+	{
+		XLogRecPtr	ptr;
+
+		if (sscanf(start_arg, "%X/%X", &ptr.xlogid, &ptr.xrecoff) != 2)
+		{
+			fprintf(stderr, _("%s: invalid WAL location \"%s\"\n"),
+					progname, start_arg);
+			exit(1);
+		}
+		start_pos = PGCD_LSN_POS(ptr);
+	}
+	else
+		start_pos = PGCD_LSN_POS(cf.checkPointCopy.redo);
+
+	ntimeouts = parse_list(timeouts_arg, &timeouts);
+	nsegments = parse_list(segments_arg, &segments);
+	nsims = ntimeouts * nsegments;
+
+	sims = pg_malloc(nsims * sizeof(walsim));
+	for (i = 0; i < ntimeouts; i++)
+	{
+		for (j = 0; j < nsegments; j++)
+		{
+			walsim	   *sim = &sims[i * nsegments + j];
+
+			memset(sim, 0, sizeof(walsim));
+			sim->timeout = timeouts[i];
+			sim->segments = segments[j];
+			sim->start_time = UNKNOWN_TIME;
+			sim->redo_pos = sim->pos = start_pos;
+		}
+	}
+
+	memset(&table, 0, sizeof(table));
+	table.nsims = nsims;
+	table.entry_size = MAXALIGN(offsetof(block_entry, last) +
+								nsims * sizeof(int32));
+
+	memset(&dir, 0, sizeof(dir));
+	dir.waldir = waldir;
+	dir.tli = cf.checkPointCopy.ThisTimeLineID;
+	dir.fd = -1;
+	pgcd_wal_reader_init(&r, read_wal_page, &dir, NULL, 0);
+
+	pos = start_pos;
+	for (;;)
+	{
+		int64		rec_start = pos;
+		XLogRecord *rec = pgcd_wal_read_record(&r, &pos);
+		block_touch touches[MAX_TOUCHES];
+		int64		rec_images;
+		double		rec_time = UNKNOWN_TIME;
+		int			ntouches;
+
+		/* grow the record buffer and try again */
+		if (rec == NULL && r.rec_needed > r.rec_size)
+		{
+			free(r.rec);
+			r.rec_size = Max(r.rec_needed, 2 * r.rec_size);
+			r.rec = pg_malloc(r.rec_size);
+			rec = pgcd_wal_read_record(&r, &pos);
+		}
+		if (rec == NULL)
+			break;
+
+		ntouches = record_touches(rec, touches, &rec_images, &rec_time);
+
+		if (rec_time != UNKNOWN_TIME)
+		{
+			now = rec_time;
+			if (first_time == UNKNOWN_TIME)
+				first_time = now;
+		}
+		if (rec->xl_rmid == RM_XLOG_ID &&
+			((rec->xl_info & ~XLR_INFO_MASK) == XLOG_CHECKPOINT_SHUTDOWN ||
+			 (rec->xl_info & ~XLR_INFO_MASK) == XLOG_CHECKPOINT_ONLINE))
+			checkpoints++;
+
+		for (i = 0; i < ntouches; i++)
+			if (touches[i].image_len > 0)
+				images++;
+		image_bytes += rec_images;
+		nrecords++;
+
+		/*
+		 * A segment switch happens with any settings: count the record
+		 * itself, then move every simulation to its next segment.
+		 */
+		if (PGCD_IS_XLOG_SWITCH(rec))
+		{
+			walsim_record(sims, nsims, &table, touches, ntouches,
+						  MAXALIGN(rec->xl_tot_len), now,
+						  images > 0 ? (double) image_bytes / images : BLCKSZ);
+			for (i = 0; i < nsims; i++)
+			{
+				if (sims[i].pos % XLogSegSize != 0)
+					sims[i].pos += XLogSegSize - sims[i].pos % XLogSegSize;
+			}
+			continue;
+		}
+
+		walsim_record(sims, nsims, &table, touches, ntouches,
+					  (pos - rec_start) - rec_images, now,
+					  images > 0 ? (double) image_bytes / images : BLCKSZ);
+	}
+
+	if (dir.fd >= 0)
+		close(dir.fd);
+
+	if (nrecords == 0)
+	{
+		fprintf(stderr, _("%s: no valid WAL found at %X/%X in \"%s\"\n"),
+				progname, (uint32) (start_pos / XLogFileSize),
+				(uint32) (start_pos % XLogFileSize), waldir);
+		exit(1);
+	}
+
+	fprintf(stderr, _("%s: read " INT64_FORMAT " records from %X/%X to %X/%X, "
+					  INT64_FORMAT " distinct blocks, %.0f s\n"),
+			progname, nrecords,
+			(uint32) (start_pos / XLogFileSize),
+			(uint32) (start_pos % XLogFileSize),
+			(uint32) (pos / XLogFileSize), (uint32) (pos % XLogFileSize),
+			(int64) table.count,
+			(first_time != UNKNOWN_TIME) ? now - first_time : 0.0);
+
+	printf("checkpoint_timeout\tcheckpoint_segments\tcheckpoints\tfull_page_images\tfpi_bytes\twal_bytes\n");
+	printf("actual\tactual\t%d\t" INT64_FORMAT "\t" INT64_FORMAT "\t" INT64_FORMAT "\n",
+		   checkpoints, images, image_bytes, pos - start_pos);
+	for (i = 0; i < nsims; i++)
+	{
+		walsim	   *sim = &sims[i];
+
+		printf("%d\t%d\t%d\t" INT64_FORMAT "\t" INT64_FORMAT "\t" INT64_FORMAT "\n",
+			   sim->timeout, sim->segments, sim->interval,
+			   sim->images, sim->image_bytes, sim->pos - start_pos);
+	}
+
+	free(table.entries);
+	free(r.rec);
+	free(sims);
+	free(timeouts);
+	free(segments);
+
+	return 0;
+}
@@ -3,6 +3,47 @@
 -- Adjust this setting to control where the objects get dropped.
 SET search_path = public;
 
+DROP FUNCTION pg_controldata_limits();
+DROP FUNCTION pg_controldata_freeze_debt(integer, float8, integer);
+DROP FUNCTION pg_controldata_archive_check(text, text);
+DROP FUNCTION pg_controldata_xid_age(bigint, bigint);
+DROP AGGREGATE pg_controldata_percentile(float8, float8);
+DROP FUNCTION pg_controldata_percentile_final(internal);
+DROP FUNCTION pg_controldata_percentile_accum(internal, float8, float8);
+DROP AGGREGATE pg_controldata_lsn_sum(bigint);
+DROP AGGREGATE pg_controldata_rate(bigint, timestamptz);
+DROP AGGREGATE pg_controldata_regr_combine(bytea);
+DROP AGGREGATE pg_controldata_regr_state(bigint, timestamptz);
+DROP FUNCTION pg_controldata_regr_span(bytea);
+DROP FUNCTION pg_controldata_regr_rate(bytea);
+DROP FUNCTION pg_controldata_regr_merge(bytea, bytea);
+DROP FUNCTION pg_controldata_regr_accum(bytea, bigint, timestamptz);
+DROP FUNCTION pg_controldata_switch_waste();
+DROP FUNCTION pg_controldata_xid_waste(float8);
+DROP FUNCTION pg_controldata_wal_rate();
+DROP FUNCTION pg_controldata_wal_samples();
+DROP FUNCTION pg_controldata_checkpoint_pressure();
+DROP FUNCTION pg_controldata_wal_residency(float8);
+DROP FUNCTION pg_controldata_startups();
+DROP FUNCTION pg_controldata_shutdown_estimate(float8, float8);
+DROP FUNCTION pg_controldata_rank_standbys(text[]);
+DROP FUNCTION pg_controldata_decode(bytea[], integer);
+DROP FUNCTION pg_controldata_image();
+DROP FUNCTION pg_controldata_lag_seconds(bigint, bigint);
+DROP FUNCTION pg_controldata_time_lsn(timestamptz);
+DROP FUNCTION pg_controldata_lsn_time(bigint);
+DROP FUNCTION pg_controldata_lsn_pos(text);
+DROP FUNCTION pg_controldata_lsn(bigint);
+DROP VIEW pg_controldata_callers;
+DROP FUNCTION pg_controldata_callers_reset();
+DROP FUNCTION pg_controldata_callers();
+DROP FUNCTION pg_controldata_alerts();
+DROP FUNCTION pg_controldata_alert_reload();
+DROP TABLE pg_controldata_alert_rule;
+DROP TABLE pg_controldata_checkpoint;
+DROP TABLE pg_controldata_history;
+DROP FUNCTION pg_controldata_history_flush();
+DROP FUNCTION pg_controldata_history();
 DROP VIEW pg_controldata;
 DROP FUNCTION pg_controldata();
 DROP FUNCTION pg_controldata_reset();